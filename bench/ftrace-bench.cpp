@@ -0,0 +1,398 @@
+#include "imgui.h"
+#include "implot.h"
+#include "implot_internal.h"
+
+#define LOG_TAG "bench"
+#include "utils.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+
+#ifdef USE_OSMESA
+#define GLAD_GL_IMPLEMENTATION
+#include <glad/gl.h>
+#include <GL/osmesa.h>
+#include <imgui_impl_opengl3.h>
+#endif
+
+#include "ftrace-plotter.h"
+
+struct view {
+	double min;
+	double max;
+};
+
+static uint32_t frames_ = 10;
+static uint32_t rows_ = 0; /* 0 means all */
+static uint32_t zoom_steps_ = 8;
+static uint32_t pan_steps_ = 8;
+static const char *script_;
+static const char *budget_;
+static bool raster_;
+static int width_ = 1920;
+static int height_ = 1080;
+static std::vector<struct view> views_;
+
+#ifdef USE_OSMESA
+static OSMesaContext osmesa_;
+static std::vector<uint8_t> framebuffer_;
+#endif
+
+static double now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void report(const char *name, double ms)
+{
+	printf("bench: %-12s %12.3f ms\n", name, ms);
+}
+
+static void report_rss(const char *name)
+{
+	struct rusage usage;
+
+	getrusage(RUSAGE_SELF, &usage);
+	printf("bench: %-12s %12ld KB\n", name, usage.ru_maxrss);
+}
+
+#ifdef USE_OSMESA
+static bool init_raster(void)
+{
+	const int attrs[] = {
+		OSMESA_FORMAT, OSMESA_RGBA,
+		OSMESA_DEPTH_BITS, 0,
+		OSMESA_PROFILE, OSMESA_CORE_PROFILE,
+		OSMESA_CONTEXT_MAJOR_VERSION, 3,
+		OSMESA_CONTEXT_MINOR_VERSION, 3,
+		0,
+	};
+
+	if (!(osmesa_ = OSMesaCreateContextAttribs(attrs, nullptr))) {
+		ee("failed to create OSMesa context\n");
+		return false;
+	}
+
+	framebuffer_.resize(size_t(width_) * height_ * 4);
+	if (!OSMesaMakeCurrent(osmesa_, framebuffer_.data(), GL_UNSIGNED_BYTE,
+	 width_, height_)) {
+		ee("failed to make OSMesa context current\n");
+		return false;
+	} else if (!gladLoadGL((GLADloadfunc) OSMesaGetProcAddress)) {
+		ee("failed to load GL functions\n");
+		return false;
+	}
+
+	ii("raster: %s\n", glGetString(GL_RENDERER));
+	return ImGui_ImplOpenGL3_Init("#version 150");
+}
+
+static double raster_frame(ImDrawData *draw_data)
+{
+	double start = now_ms();
+
+	glViewport(0, 0, width_, height_);
+	glClearColor(0, 0, 0, 1);
+	glClear(GL_COLOR_BUFFER_BIT);
+	ImGui_ImplOpenGL3_RenderDrawData(draw_data);
+	glFinish();
+
+	return now_ms() - start;
+}
+
+static void clean_raster(void)
+{
+	ImGui_ImplOpenGL3_Shutdown();
+	OSMesaDestroyContext(osmesa_);
+}
+#else
+static bool init_raster(void)
+{
+	ee("built without OSMesa support, rebuild with -DUSE_OSMESA=ON\n");
+	return false;
+}
+
+static double raster_frame(ImDrawData *draw_data)
+{
+	return 0;
+}
+
+static void clean_raster(void)
+{
+}
+#endif
+
+/* no window, ImGui only needs font atlas to be built unless we rasterize */
+static bool init_gui(void)
+{
+	ImGui::CreateContext();
+	ImPlot::CreateContext();
+
+	ImGuiIO &io = ImGui::GetIO();
+	io.IniFilename = nullptr;
+	io.DisplaySize = ImVec2(width_, height_);
+	io.DeltaTime = 1. / 60;
+	io.Fonts->AddFontDefault();
+
+	if (raster_)
+		return init_raster();
+
+	unsigned char *pixels;
+	int w, h;
+	io.Fonts->GetTexDataAsRGBA32(&pixels, &w, &h);
+	io.Fonts->SetTexID((ImTextureID) 1);
+	return true;
+}
+
+static void clean_gui(void)
+{
+	if (raster_)
+		clean_raster();
+
+	ImPlot::DestroyContext();
+	ImGui::DestroyContext();
+}
+
+static bool load_script(void)
+{
+	FILE *f = fopen(script_, "r");
+	if (!f) {
+		ee("failed to open '%s'\n", script_);
+		return false;
+	}
+
+	char line[256];
+	while (fgets(line, sizeof(line), f)) {
+		struct view v;
+		if (line[0] == '#')
+			continue;
+		else if (sscanf(line, "%lf %lf", &v.min, &v.max) != 2)
+			continue;
+		else if (v.min < v.max)
+			views_.push_back(v);
+	}
+
+	fclose(f);
+	ii("loaded %zu views from '%s'\n", views_.size(), script_);
+	return true;
+}
+
+/* zoom into the middle of the trace by halving x range on every step, then
+ * pan over the whole trace at the deepest zoom level
+ */
+static void make_script(void)
+{
+	double mid = plot_.max_x / 2;
+	double half = plot_.max_x / 2;
+
+	for (uint32_t i = 0; i < zoom_steps_; ++i) {
+		views_.push_back({ mid - half, mid + half });
+		half /= 2;
+	}
+
+	if (!pan_steps_)
+		return;
+
+	double step = (plot_.max_x - half * 2) / pan_steps_;
+	for (uint32_t i = 0; i <= pan_steps_; ++i)
+		views_.push_back({ i * step, i * step + half * 2 });
+}
+
+static void select_rows(void)
+{
+	uint32_t rows = 0;
+
+	for (auto &axis : plot_.y_axes) {
+		if (rows_ && rows >= rows_ && !axis.gpu)
+			continue;
+
+		axis.selected = true;
+		rows++;
+	}
+
+	ii("selected %u of %zu rows\n", rows, plot_.y_axes.size());
+}
+
+static double render_frame(ImDrawData **draw_data)
+{
+	double start = now_ms();
+
+#ifdef USE_OSMESA
+	if (raster_)
+		ImGui_ImplOpenGL3_NewFrame();
+#endif
+	ImGui::NewFrame();
+	plot(width_, height_);
+	ImGui::Render();
+	*draw_data = ImGui::GetDrawData();
+
+	return now_ms() - start;
+}
+
+static void bench_frames(void)
+{
+	ImDrawData *data = nullptr;
+	double first = render_frame(&data);
+	double total = 0;
+	double max = 0;
+
+	report("first frame", first);
+
+	for (uint32_t i = 0; i < frames_; ++i) {
+		double ms = render_frame(&data);
+		total += ms;
+		if (max < ms)
+			max = ms;
+	}
+
+	if (frames_) {
+		report("frame mean", total / frames_);
+		report("frame max", max);
+	}
+
+	if (data) {
+		printf("bench: %-12s %12d vtx %12d idx\n", "draw data",
+		 data->TotalVtxCount, data->TotalIdxCount);
+	}
+}
+
+static void bench_views(void)
+{
+	double cpu_total = 0;
+	double cpu_max = 0;
+	double raster_total = 0;
+
+	for (size_t i = 0; i < views_.size(); ++i) {
+		ImDrawData *data;
+
+		plot_.set_view = true;
+		plot_.view_min = views_[i].min;
+		plot_.view_max = views_[i].max;
+
+		double cpu = render_frame(&data);
+		double raster = raster_ ? raster_frame(data) : 0;
+
+		printf("frame: %3zu %12f %12f cpu %10.3f ms raster %10.3f ms "
+		 "vtx %10d idx %10d\n", i, views_[i].min, views_[i].max, cpu,
+		 raster, data->TotalVtxCount, data->TotalIdxCount);
+
+		cpu_total += cpu;
+		raster_total += raster;
+		if (cpu_max < cpu)
+			cpu_max = cpu;
+	}
+
+	if (views_.size()) {
+		report("view mean", cpu_total / views_.size());
+		report("view max", cpu_max);
+		if (raster_)
+			report("raster mean", raster_total / views_.size());
+	}
+}
+
+static void help(const char *name)
+{
+	printf("Usage: %s [options] <tracelog>\n"
+	 "\033[2m"
+	 " --frames <n>   number of frames to render after first one (%u)\n"
+	 " --rows <n>     number of lanes to select, 0 for all (%u)\n"
+	 " --size <WxH>   frame size (%dx%d)\n"
+	 " --zoom <n>     scripted zoom steps (%u)\n"
+	 " --pan <n>      scripted pan steps at deepest zoom (%u)\n"
+	 " --script <f>   file with '<min> <max>' x ranges, one per frame\n"
+	 " --raster       rasterize frames with OSMesa\n"
+	 " --budget <mb>  page points out under memory budget, defaults to\n"
+	 "                MEM_BUDGET_MB\n"
+	 "\033[0m", name, frames_, rows_, width_, height_, zoom_steps_,
+	 pan_steps_);
+}
+
+static const char *getopts(int argc, const char *argv[])
+{
+	const char *arg;
+
+	for (int i = 1; i < argc; ++i) {
+		arg = argv[i];
+		if (arg[0] != '-') {
+			return arg;
+		} else if (strcmp(arg, "--raster") == 0) {
+			raster_ = true;
+		} else if (i + 1 >= argc) {
+			break;
+		} else if (strcmp(arg, "--frames") == 0) {
+			frames_ = atoi(argv[++i]);
+		} else if (strcmp(arg, "--rows") == 0) {
+			rows_ = atoi(argv[++i]);
+		} else if (strcmp(arg, "--zoom") == 0) {
+			zoom_steps_ = atoi(argv[++i]);
+		} else if (strcmp(arg, "--pan") == 0) {
+			pan_steps_ = atoi(argv[++i]);
+		} else if (strcmp(arg, "--script") == 0) {
+			script_ = argv[++i];
+		} else if (strcmp(arg, "--budget") == 0) {
+			budget_ = argv[++i];
+		} else if (strcmp(arg, "--size") == 0) {
+			const char *h_str;
+			arg = argv[++i];
+			width_ = atoi(arg);
+			if ((h_str = strchr(arg, 'x')))
+				height_ = atoi(h_str + 1);
+		} else {
+			break;
+		}
+	}
+
+	return nullptr;
+}
+
+int main(int argc, const char *argv[])
+{
+	const char *path;
+	double start;
+
+	budget_ = getenv("MEM_BUDGET_MB");
+	if (!(path = getopts(argc, argv))) {
+		help(argv[0]);
+		return 1;
+	}
+
+	if (!init_budget(budget_))
+		return 1;
+
+	start = now_ms();
+	if (!open_data(path))
+		return 1;
+	report("open_data", now_ms() - start);
+
+	start = now_ms();
+	if (!init_data())
+		return 1;
+	report("init_data", now_ms() - start);
+
+	start = now_ms();
+	sort_y_axes();
+	report("sort_y_axes", now_ms() - start);
+
+	plot_.filename = path;
+	drop_loaded_pages();
+	report_rss("load peak");
+
+	if (!init_gui())
+		return 1;
+
+	if (script_ && !load_script())
+		return 1;
+	else if (!script_)
+		make_script();
+
+	select_rows();
+	bench_frames();
+	bench_views();
+	report_rss("peak rss");
+	clean_gui();
+	return 0;
+}
@@ -0,0 +1,6 @@
+/* imgui OpenGL3 backend on top of glad loaded from OSMesa context instead of
+ * imgui's own libGL loader
+ */
+#define IMGUI_IMPL_OPENGL_LOADER_CUSTOM
+#include <glad/gl.h>
+#include "imgui_impl_opengl3.cpp"
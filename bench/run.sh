@@ -0,0 +1,37 @@
+#!/bin/sh
+#
+# Generate synthetic traces and run headless viewer benchmark on them.
+#
+# Usage: bench/run.sh [build-dir] [events...]
+#
+# Traces are written to $TMPDIR and removed afterwards. Default sizes are
+# 1M and 10M events; 100M runs only when passed explicitly since it needs
+# ~15 GB of disk and RAM.
+#
+# Extra ftrace-bench options can be passed via BENCH_ARGS, e.g.
+# CMAKE_ARGS=-DUSE_OSMESA=ON BENCH_ARGS="--raster --zoom 12" to rasterize.
+# MEM_BUDGET_MB=64 runs with points paged out, peak RSS is reported either
+# way.
+
+set -e
+
+src=$(cd "$(dirname "$0")/.." && pwd)
+build=${1:-$src/_bench_build}
+[ $# -gt 0 ] && shift
+sizes=${*:-1000000 10000000}
+tmp=${TMPDIR:-/tmp}
+
+cmake -S "$src" -B "$build" -DCMAKE_BUILD_TYPE=Release -DBUILD_BENCH=ON \
+ $CMAKE_ARGS >/dev/null
+cmake --build "$build" --target tracegen ftrace-bench -j"$(nproc)" \
+ >/dev/null
+
+for n in $sizes; do
+	trace=$tmp/ftrace-bench-$n.txt
+	echo "== $n events"
+	"$build/tools/tracegen/tracegen" --events "$n" --tasks 64 --cpus 8 \
+	 --rate 1000000 --output "$trace"
+	"$build/ftrace-bench" --frames ${FRAMES:-10} $BENCH_ARGS "$trace" \
+	 | grep -E '^(bench|frame):'
+	rm -f "$trace"
+done
@@ -3,15 +3,26 @@
 
 #include <sys/mman.h>
 #include <ctype.h>
+#include <math.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 
 #include <vector>
 #include <string>
+#include <string_view>
+#include <algorithm>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "pool.h"
+#include "pages.h"
 
 constexpr uint16_t max_buf_ = 4096;
-constexpr int mmap_proto_ = PROT_READ | PROT_WRITE;
+constexpr int mmap_proto_ = PROT_READ; /* parsed from copies of blocks */
+constexpr size_t parse_block_ = 1 << 20; /* bytes of whole lines */
+constexpr size_t name_block_ = 64 << 10;
 constexpr double y_scale_ = .001;
 constexpr float fill_alpha_ = .2;
 constexpr float y_low_ = .05;
@@ -37,11 +48,40 @@ constexpr ImGuiWindowFlags win_flags_ = ImGuiWindowFlags_NoBackground |
 constexpr uint32_t dot_color_ = IM_COL32(255, 255, 255, 200);
 constexpr uint32_t text_color_ = IM_COL32(200, 200, 200, 255);
 constexpr uint32_t cursor_color_ = IM_COL32(40, 40, 40, 255);
+constexpr uint32_t jank_color_ = IM_COL32(238, 40, 40, 200);
+constexpr uint32_t jank_span_color_ = IM_COL32(238, 40, 40, 40);
+constexpr float flow_alpha_ = .6;
+constexpr uint32_t path_color_ = IM_COL32(255, 170, 0, 220);
+constexpr uint32_t path_wait_color_ = IM_COL32(255, 170, 0, 80);
+constexpr float path_band_ = .08; /* above run level */
+constexpr uint32_t max_path_steps_ = 1000000;
+constexpr uint32_t irq_color_ = IM_COL32(238, 60, 60, 200);
+constexpr uint32_t softirq_color_ = IM_COL32(170, 90, 238, 200);
+constexpr float irq_band_ = .05; /* below run level */
+constexpr uint32_t migrate_color_ = IM_COL32(40, 220, 220, 220);
+constexpr uint32_t range_color_ = IM_COL32(120, 160, 255, 40);
+constexpr uint32_t util_color_ = IM_COL32(255, 255, 255, 160);
+constexpr float span_base_ = .5; /* flame chart above run level */
+constexpr float span_height_ = .1;
+constexpr uint8_t max_span_depth_ = 4; /* deeper spans are not drawn */
+constexpr uint32_t min_m4_points_ = 4096; /* fewer are drawn as is */
+constexpr float dot_spacing_ = 8; /* min pixels between samples for dots */
+constexpr uint8_t m4_pinned_level_ = 6; /* kept when points are paged out */
+constexpr char submit_tag_[] = "vkmon_vkQueueSubmit id ";
 
 enum trace_type : uint8_t {
 	TRACE_MARKER,
 	TRACE_SCHED_SWITCH,
 	TRACE_SCHED_TASK_STAT, /* custom trace */
+	TRACE_SCHED_WAKEUP,
+	TRACE_SCHED_WAKING,
+	TRACE_IRQ_ENTRY,
+	TRACE_IRQ_EXIT,
+	TRACE_SOFTIRQ_ENTRY,
+	TRACE_SOFTIRQ_EXIT,
+	TRACE_CPU_FREQUENCY,
+	TRACE_CPU_IDLE,
+	TRACE_SCHED_MIGRATE,
 };
 
 struct gpu_job {
@@ -64,25 +104,188 @@ struct point {
 	bool visible = false;
 	double xx = -1; /* GPU job stop timestamp */
 	ImU32 color; /* for GPU jobs */
+	uint32_t flow = UINT32_MAX; /* index in plot_.flows for GPU jobs */
+};
+
+/* points are collected in memory or, under memory budget, streamed to
+ * temporary file while trace is parsed and used in place from its mapping
+ */
+struct point_array : paged_array<struct point> {};
+
+/* vkQueueSubmit marker and GPU job it produced, both carry same id */
+struct flow {
+	uint32_t pid = 0; /* submitting thread */
+	uint32_t job_pid = 0;
+	double submit_ts = -1;
+	double start_ts = -1; /* GPU job start */
+};
+
+/* wakeup graph edge, stored per wakee */
+struct wakeup {
+	double ts;
+	uint32_t waker; /* 0 if woken from hardirq or softirq */
+	uint16_t cpu; /* target cpu */
+	bool waking; /* sched_waking, i.e. earlier than sched_wakeup */
+};
+
+/* critical path piece: 'R' running, 'W' runnable, 'S' blocked for reason
+ * not seen in trace
+ */
+struct path_segment {
+	uint32_t pid;
+	double start;
+	double stop;
+	char state;
+};
+
+struct irq_span {
+	double start;
+	double stop;
+	uint16_t nr; /* irq line or softirq vector */
+};
+
+/* hardirqs can interrupt softirqs, so keep them apart to have both arrays
+ * sorted by start
+ */
+struct cpu_irqs {
+	std::vector<struct irq_span> hard;
+	std::vector<struct irq_span> soft;
+	struct irq_span hard_entry = { -1, -1, 0 }; /* pending entries */
+	struct irq_span soft_entry = { -1, -1, 0 };
+};
+
+struct migration {
+	double ts;
+	uint16_t from;
+	uint16_t to;
+};
+
+/* run slices of a task or a cpu with prefix sums for range queries */
+/* paged out along with points */
+struct run_index {
+	paged_array<double> start;
+	paged_array<double> stop;
+	paged_array<double> cum; /* run time of slices before i, n + 1 items */
+	paged_array<float> max; /* segment tree of slice lengths, 2n items */
+};
+
+struct range_stats {
+	size_t axis; /* index in y_axes */
+	double run = 0;
+	size_t slices = 0;
+	double max = 0;
+};
+
+/* B/E or S/F marker pair, name is interned */
+struct span {
+	double start;
+	double stop;
+	const char *name;
+};
+
+struct async_span {
+	uint16_t id; /* axis of S marker */
+	struct span span;
+};
+
+struct span_stats {
+	const char *name;
+	size_t count;
+	double mean; /* ms */
+	double p99;
+	double max;
+	double total;
+};
+
+/* sample indices of the first, min, max and last sample in bucket, first is
+ * none_ for empty one
+ */
+struct m4_bucket {
+	uint32_t first;
+	uint32_t min;
+	uint32_t max;
+	uint32_t last;
+};
+
+/* renderer hook, returns texture to draw pixels (RGBA) with */
+typedef ImTextureID (*texture_upload)(const uint32_t *pixels, int w, int h);
+
+/* run share of selected tasks in pixel sized time buckets; tasks get
+ * averaged when there are more of them than pixel rows
+ */
+struct heatmap {
+	std::vector<uint32_t> pixels;
+	std::vector<uint16_t> rows; /* axes top to bottom */
+	int w = 0;
+	int h = 0;
+	double min = 0; /* time range of pixels */
+	double max = 0;
+	ImTextureID tex = 0;
+	bool dirty = false; /* pixels not uploaded yet */
+	uint32_t lut[256] = {0};
+};
+
+struct freq_step {
+	double ts;
+	uint32_t khz;
+};
+
+struct frame_stats {
+	double p50 = 0; /* frame times in ms */
+	double p90 = 0;
+	double p99 = 0;
+	double max = 0;
+	uint32_t count = 0;
+	uint32_t jank = 0;
 };
 
 struct y_axis {
 	uint32_t pid = 0;
 	double max_y = 0;
 	std::string name;
+	std::string label; /* monitor label */
 	char list_name[32] = {0};
-	std::vector<struct point> points;
+	struct point_array points;
 	std::vector<double> markers;
 	std::vector<struct marker_label> marker_labels;
 	bool selected = false;
 	bool added = false;
 	bool monitor = false;
 	bool gpu = false;
+	bool frame = false; /* present markers */
+	bool power = false; /* cpu frequency or idle state */
 	bool measure = false;
 	float prev_ex = -1;
+	struct frame_stats frame_stats;
 	ImVec4 color;
 	float x_offset = 0;
 	float y_offset = 0;
+	double run_time = 0; /* seconds */
+	double work_time = 0; /* run time scaled by frequency / max frequency */
+	std::vector<double> cpu_time; /* run time by cpu */
+	std::vector<struct migration> migrations;
+	double migration_rate = 0; /* per second of task lifetime */
+	struct run_index run_index;
+	/* spans don't overlap on same depth, so every depth is sorted both by
+	 * start and by stop
+	 */
+	std::vector<std::vector<struct span>> spans; /* by depth */
+	/* monitor samples decimated into time buckets, every level doubles
+	 * bucket width of the previous one
+	 */
+	std::vector<std::vector<struct m4_bucket>> m4;
+	double m4_width = 0; /* level 0 bucket width */
+	double m4_origin = 0; /* first sample time, buckets start there */
+	/* samples of m4 levels from m4_base up, drawn instead of m4 buckets
+	 * once points are paged out
+	 */
+	std::vector<std::vector<ImPlotPoint>> m4_samples;
+	uint8_t m4_base = 0;
+	std::vector<uint32_t> labels; /* monitor samples with value shown */
+	uint64_t plot_frame = 0; /* last frame plot was shown in */
+	ImVec2 plot_pos; /* plot layout in that frame for flows */
+	ImVec2 plot_size;
+	ImPlotRect plot_rect;
 };
 
 struct marker_label {
@@ -94,27 +297,48 @@ struct marker_label {
 struct plot_data {
 	const char *comm = nullptr;
 	char *marker = nullptr;
+	const char *label = nullptr; /* monitor label */
+	double value = 0; /* monitor value */
 	bool monitor = false;
 	bool gpu = false;
+	bool frame = false;
+	bool power = false;
+	bool span = false; /* B/E marker */
+	bool async = false; /* S/F marker */
+	bool counter = false; /* C marker */
 	uint32_t pid;
 	double ts;
 	double raw_ts;
 	bool arrived;
-	uint8_t cpu;
+	uint16_t cpu;
 	uint64_t pcount;
-	uint8_t id;
+	uint16_t id;
 	uint16_t prio;
 	char state;
 };
 
+/* names which outlive parsing, i.e. marker labels and span names, are
+ * copied here from the block being parsed, equal ones once
+ */
+struct name_table {
+	std::unordered_set<std::string_view> names; /* load time only */
+	std::vector<std::unique_ptr<char[]>> blocks;
+	size_t used = 0; /* bytes in last block */
+	size_t size = 0; /* bytes in all blocks */
+};
+
 struct plot {
 	int fd = -1;
 	const char *filename;
-	char *data;
+	const char *data;
 	size_t file_size;
 	double max_x;
-	std::vector<struct plot_data> plot_data;
+	size_t data_count = 0; /* points of all lanes */
+	double data_min = 0; /* time of the first and the last point */
+	double data_max = 0;
 	std::vector<struct y_axis> y_axes;
+	/* axis key to its index, load time only since axes get sorted later */
+	std::unordered_map<uint64_t, uint16_t> axis_ids;
 	uint16_t id = 0;
 	uint16_t gpu_plot_id = 0;
 	double min_ts = 0;
@@ -127,6 +351,56 @@ struct plot {
 	bool event = false;
 	bool reset_measure = false;
 	bool reset_labels = false;
+	bool set_view = false; /* force x range for one frame */
+	double view_min;
+	double view_max;
+	float jank_factor = 1.5; /* of target frame time */
+	float target_ms = 0; /* 0 means median frame time */
+	std::vector<struct flow> flows; /* sorted by submit_ts */
+	std::unordered_map<int32_t, size_t> flow_ids; /* load time only */
+	double max_flow_lag = 0; /* max |start_ts - submit_ts| */
+	bool show_flows = true;
+	bool jump_view = false; /* set view in next frame */
+	uint64_t frame = 0;
+	std::unordered_map<uint32_t, std::vector<struct wakeup>> wakeups;
+	bool has_waking = false;
+	std::vector<struct path_segment> path; /* sorted by start */
+	double path_start = 0;
+	double path_stop = 0;
+	double path_run = 0; /* seconds by segment state */
+	double path_wait = 0;
+	double path_blocked = 0;
+	uint32_t path_tasks = 0;
+	bool path_event = false;
+	std::vector<struct cpu_irqs> irqs; /* by cpu */
+	bool show_irqs = true;
+	std::vector<std::vector<struct freq_step>> freqs; /* by cpu */
+	uint32_t max_khz = 0;
+	/* sched_migrate_task by pid, moved to axes after parsing */
+	std::unordered_map<uint32_t, std::vector<struct migration>> migrations;
+	bool has_migrate = false;
+	std::vector<struct run_index> cpu_index; /* busy slices by cpu */
+	double range_min = 0; /* selected with middle mouse button drag */
+	double range_max = 0;
+	bool range_drag = false;
+	bool range_valid = false;
+	std::vector<struct range_stats> range_stats;
+	std::vector<double> range_cpus; /* busy time by cpu */
+	bool show_util = false;
+	float util_bucket_ms = 0; /* 0 means one pixel */
+	/* open B markers by pid, load time only */
+	std::unordered_map<uint32_t, std::vector<struct span>> span_stacks;
+	/* open S markers by '<pid>|<name>|<cookie>' and finished ones, moved to
+	 * axes after parsing
+	 */
+	std::unordered_map<std::string, struct async_span> async_open;
+	std::vector<struct async_span> async_spans;
+	std::vector<struct span_stats> span_stats; /* by total time */
+	struct name_table names;
+	bool show_span_stats = false;
+	struct heatmap heatmap;
+	bool show_heatmap = false;
+	texture_upload upload_texture = nullptr; /* no heatmap without it */
 };
 
 static struct plot plot_;
@@ -229,6 +503,19 @@ static inline bool is_eol(char *ptr)
 	return (*ptr == '\n' || *ptr == '\r');
 }
 
+/* FNV-1a */
+static inline uint32_t hash_str(const char *str, size_t len)
+{
+	uint32_t hash = 2166136261u;
+
+	for (size_t i = 0; i < len; ++i) {
+		hash ^= (uint8_t) str[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
 static inline bool is_monitor(char *ptr)
 {
 	return (*ptr == 'm' && *(ptr + 1) == 'o' && *(ptr + 2) == 'n' &&
@@ -241,6 +528,50 @@ static inline bool is_gpu(char *ptr)
 	 *(ptr + 3) == ',');
 }
 
+static inline bool is_frame(char *ptr)
+{
+	return strncmp(ptr, "present,", 8) == 0;
+}
+
+/* B|<name>, B|<pid>|<name>, E|<name>, E|<pid> or just E */
+static inline bool is_span(char *ptr)
+{
+	if (ptr[0] == 'B')
+		return ptr[1] == '|';
+	else if (ptr[0] == 'E')
+		return ptr[1] == '|' || ptr[1] == '\0';
+
+	return false;
+}
+
+static inline const char *get_span_name(char *ptr)
+{
+	char *tmp = ptr += 2; /* skip 'B|' */
+
+	while (isdigit(*tmp))
+		tmp++;
+
+	return (tmp > ptr && *tmp == '|') ? tmp + 1 : ptr;
+}
+
+/* atrace S|<pid>|<name>|<cookie>, F|<pid>|<name>|<cookie> and
+ * C|<pid>|<name>|<value>
+ */
+static inline bool is_async(char *ptr)
+{
+	return (ptr[0] == 'S' || ptr[0] == 'F') && ptr[1] == '|';
+}
+
+static inline bool is_counter(char *ptr)
+{
+	return ptr[0] == 'C' && ptr[1] == '|';
+}
+
+static inline bool is_submit(char *ptr)
+{
+	return strncmp(ptr, submit_tag_, sizeof(submit_tag_) - 1) == 0;
+}
+
 static inline char *get_field_end(char *ptr, char *end)
 {
 	while (ptr < end) {
@@ -271,7 +602,7 @@ static inline char *get_taskpid_str(char *ptr, char *end, char **next)
 	*next = tmp; /* next field to parse */
 	**next = '\0';
 
-	remove_trailing_blanks(tmp, ptr);
+	remove_trailing_blanks(tmp - 1, ptr);
 	return ptr;
 }
 
@@ -328,7 +659,7 @@ static bool open_data(const char *path)
 
 	lseek(plot_.fd, 0, SEEK_SET); // restore cursor, ignore errors
 	errno = 0;
-	plot_.data = (char *) mmap(nullptr, plot_.file_size, mmap_proto_,
+	plot_.data = (const char *) mmap(nullptr, plot_.file_size, mmap_proto_,
 	 MAP_PRIVATE, plot_.fd, 0);
 
 	if (plot_.data == MAP_FAILED) {
@@ -432,24 +763,72 @@ static void parse_gpu_job(struct plot_data *data, struct gpu_job *job)
 
 static inline void set_axis_name(struct y_axis *axis, const char *comm)
 {
+	if (axis->power) {
+		axis->name = " " + axis->label;
+		return;
+	}
+
 	axis->name = " ";
 	axis->name += comm;
 	axis->name += " ";
 	axis->name += std::to_string(axis->pid);
+
+	if (!axis->label.empty()) {
+		axis->name += " ";
+		axis->name += axis->label;
+	}
+}
+
+static inline bool is_axis(struct y_axis *axis, struct plot_data *data)
+{
+	if (axis->pid != data->pid || axis->monitor != data->monitor)
+		return false;
+	else if (axis->frame != data->frame)
+		return false;
+	else if (data->monitor)
+		return axis->label == data->label;
+
+	return true;
+}
+
+/* pid and lane kind in low bits, monitor label hash above them */
+static inline uint64_t get_axis_key(struct plot_data *data)
+{
+	uint64_t key = data->pid;
+
+	if (data->gpu)
+		return UINT64_MAX; /* one lane for all jobs */
+
+	key |= (uint64_t) data->monitor << 32;
+	key |= (uint64_t) data->frame << 33;
+
+	if (data->monitor && data->label)
+		key |= (uint64_t) hash_str(data->label, strlen(data->label)) << 34;
+
+	return key;
 }
 
 static void update_y_axis(const char *comm, struct plot_data *data)
 {
-	for (size_t i = 0; i < plot_.y_axes.size(); ++i) {
-		if (data->gpu && plot_.y_axes[i].gpu) {
-			data->id = i;
-			return;
-		} else if (plot_.y_axes[i].pid == data->pid && !data->gpu) {
+	uint64_t key = get_axis_key(data);
+	auto it = plot_.axis_ids.find(key);
+	bool indexed = it != plot_.axis_ids.end();
+
+	if (indexed && (data->gpu || is_axis(&plot_.y_axes[it->second], data))) {
+		data->id = it->second;
+		/* also update name so it matches actual process; otherwise,
+		 * if process is invoked by shell script the script name will
+		 * be displayed
+		 */
+		if (!data->gpu)
+			set_axis_name(&plot_.y_axes[it->second], comm);
+		return;
+	}
+
+	/* lanes with colliding keys are rare enough for linear search */
+	for (size_t i = 0; indexed && i < plot_.y_axes.size(); ++i) {
+		if (!plot_.y_axes[i].gpu && is_axis(&plot_.y_axes[i], data)) {
 			data->id = i;
-			/* also update name so it matches actual process;
-			 * otherwise, if process is invoked by shell script
-			 * the script name will be displayed
-			 */
 			set_axis_name(&plot_.y_axes[i], comm);
 			return;
 		}
@@ -458,10 +837,20 @@ static void update_y_axis(const char *comm, struct plot_data *data)
 	data->id = plot_.id;
 	plot_.id++;
 
+	if (!indexed)
+		plot_.axis_ids[key] = data->id;
+
 	struct y_axis axis;
 
 	if (!data->gpu) {
 		axis.pid = data->pid;
+		axis.monitor = data->monitor;
+		axis.frame = data->frame;
+		axis.power = data->power;
+		if (data->label)
+			axis.label = data->label;
+		else if (data->frame)
+			axis.label = "frames";
 		set_axis_name(&axis, comm);
 		axis.color = generate_color(&axis, data->id);
 	} else {
@@ -477,6 +866,46 @@ static void update_y_axis(const char *comm, struct plot_data *data)
 	plot_.y_axes.push_back(std::move(axis));
 }
 
+static struct flow *get_flow(int32_t id)
+{
+	auto it = plot_.flow_ids.find(id);
+	if (it != plot_.flow_ids.end())
+		return &plot_.flows[it->second];
+
+	plot_.flow_ids[id] = plot_.flows.size();
+	plot_.flows.push_back(flow{});
+	return &plot_.flows.back();
+}
+
+/* data format: vkmon_vkQueueSubmit id <id> queue <ptr> seq <seq> */
+static void add_flow_submit(struct plot_data *data)
+{
+	struct flow *flow = get_flow(atoi(data->marker + sizeof(submit_tag_) - 1));
+	flow->pid = data->pid;
+	flow->submit_ts = data->ts;
+}
+
+/* returns flow index, it is remapped once flows are paired and sorted */
+static uint32_t add_flow_job(struct gpu_job *job)
+{
+	if (job->id < 0)
+		return UINT32_MAX;
+
+	struct flow *flow = get_flow(job->id);
+	flow->job_pid = job->pid;
+	flow->start_ts = job->start_ts;
+	return flow - plot_.flows.data();
+}
+
+/* parsed records are not kept, only their time span */
+static inline void count_data(struct plot_data *data)
+{
+	if (!plot_.data_count++)
+		plot_.data_min = data->ts;
+
+	plot_.data_max = data->ts;
+}
+
 static void add_data_point(struct plot_data *data)
 {
 	struct y_axis *axis = &plot_.y_axes[data->id];
@@ -501,11 +930,14 @@ static void add_data_point(struct plot_data *data)
 		point.cpu = job.id; /* NB: use cpu field */
 		point.pid = job.pid;
 		point.arrived = true;
+		point.flow = add_flow_job(&job);
+	} else if (axis->frame) {
+		point.arrived = true;
 	} else if (!axis->monitor) {
 		(data->arrived) ? (point.arrived = true) : (point.arrived = false);
-	} else if (data->marker) {
+	} else if (data->marker || data->power) {
 		point.arrived = true;
-		point.y = double(atol(data->marker + 4));
+		point.y = data->value;
 		if (axis->max_y < point.y)
 			axis->max_y = point.y;
 	} else {
@@ -515,15 +947,74 @@ static void add_data_point(struct plot_data *data)
 	axis->points.push_back(std::move(point));
 }
 
+/* data format: mon,<value>,<label>[,<value>,<label>...]
+ * perfmon puts all sources sampled on the same tick into one marker, every
+ * label gets its own lane
+ */
+static void add_monitor_points(struct plot_data *data)
+{
+	char *ptr = data->marker + 4; /* skip 'mon,' */
+
+	while (*ptr != '\0') {
+		struct plot_data mon = *data;
+		char *tmp;
+
+		mon.value = atof(ptr);
+		mon.label = "";
+
+		if ((tmp = strchr(ptr, ','))) {
+			mon.label = ++tmp;
+			if ((tmp = strchr(tmp, ','))) {
+				*tmp = '\0';
+				ptr = tmp + 1;
+			} else {
+				ptr += strlen(ptr);
+			}
+		} else {
+			ptr += strlen(ptr);
+		}
+
+		update_y_axis(mon.comm, &mon);
+		add_data_point(&mon);
+		count_data(&mon);
+	}
+}
+
+static const char *intern_name(const char *str)
+{
+	struct name_table *table = &plot_.names;
+	auto it = table->names.find(str);
+
+	if (it != table->names.end())
+		return it->data();
+
+	size_t len = strlen(str) + 1;
+
+	if (table->blocks.empty() || table->used + len > name_block_) {
+		size_t size = std::max(name_block_, len);
+
+		table->blocks.emplace_back(new char[size]);
+		table->used = 0;
+		table->size += size;
+	}
+
+	char *name = table->blocks.back().get() + table->used;
+
+	memcpy(name, str, len);
+	table->used += len;
+	table->names.insert(std::string_view(name, len - 1));
+	return name;
+}
+
 static void update_y_markers(struct plot_data *data, uint32_t pid)
 {
 	for (auto &axis : plot_.y_axes) {
 		/* ignore markers' leftovers from incomplete log */
-		if (axis.pid == pid && axis.points.size()) {
+		if (axis.pid == pid && !axis.frame && axis.points.size()) {
 			axis.markers.push_back(data->ts);
 
 			struct marker_label l;
-			l.name = data->marker;
+			l.name = intern_name(data->marker);
 			l.ts = data->ts;
 			axis.marker_labels.push_back(std::move(l));
 			break;
@@ -531,6 +1022,60 @@ static void update_y_markers(struct plot_data *data, uint32_t pid)
 	}
 }
 
+/* spans are matched per task with a stack, unmatched E is ignored */
+static void add_span(struct plot_data *data)
+{
+	std::vector<struct span> *stack = &plot_.span_stacks[data->pid];
+
+	if (data->marker[0] == 'B') {
+		stack->push_back({ data->ts, -1,
+		 intern_name(get_span_name(data->marker)) });
+		return;
+	} else if (stack->empty()) {
+		return;
+	}
+
+	struct y_axis *axis = &plot_.y_axes[data->id];
+	size_t depth = stack->size() - 1;
+
+	if (axis->spans.size() <= depth)
+		axis->spans.resize(depth + 1);
+
+	stack->back().stop = data->ts;
+	axis->spans[depth].push_back(stack->back());
+	stack->pop_back();
+}
+
+/* S and F are matched by the rest of marker, i.e. pid, name and cookie;
+ * unmatched F is ignored
+ */
+static void add_async(struct plot_data *data)
+{
+	char *ptr = data->marker + 2; /* skip 'S|' */
+	std::string key(ptr);
+	char *name = strchr(ptr, '|');
+	char *cookie = strrchr(ptr, '|');
+
+	if (!name || cookie == name)
+		return;
+
+	*cookie = '\0'; /* ends name */
+
+	if (data->marker[0] == 'S') {
+		plot_.async_open[key] = { data->id,
+		 { data->ts, -1, intern_name(name + 1) } };
+		return;
+	}
+
+	auto it = plot_.async_open.find(key);
+	if (it == plot_.async_open.end())
+		return;
+
+	it->second.span.stop = data->ts;
+	plot_.async_spans.push_back(it->second);
+	plot_.async_open.erase(it);
+}
+
 static void add_items(struct y_axis *axis, std::vector<struct y_axis> *axes)
 {
 	for (size_t i = 0; i < plot_.y_axes.size(); ++i) {
@@ -538,10 +1083,14 @@ static void add_items(struct y_axis *axis, std::vector<struct y_axis> *axes)
 			char prefix;
 			if (plot_.y_axes[i].markers.size())
 				prefix = '*';
+			else if (plot_.y_axes[i].power)
+				prefix = '~';
 			else if (plot_.y_axes[i].monitor)
 				prefix = '=';
 			else if (plot_.y_axes[i].gpu)
 				prefix = '#';
+			else if (plot_.y_axes[i].frame)
+				prefix = '>';
 			else
 				prefix = ' ';
 
@@ -709,361 +1258,2456 @@ static char *parse_sched_switch(struct plot_data *data, char *ptr, char *end)
 	return next;
 }
 
-static bool init_data(void)
+/* value of '<key>' field, e.g. 'irq=', within line; -1 if missing */
+static long get_key_value(char *ptr, char *eol, const char *key, size_t len)
 {
-	char *ptr = plot_.data;
-	char *end = plot_.data + plot_.file_size;
-	char *next;
-	bool marker;
-	enum trace_type type;
-	double trace_ts;
-	uint32_t trace_pid;
-	uint32_t trace_cpu;
-	char *trace_comm = nullptr;
+	if (!(ptr = (char *) memmem(ptr, eol - ptr, key, len)))
+		return -1;
 
-	while (ptr < end) {
-		if (*ptr == '#') {
-			ptr = strchr(ptr, '\n');
-			ptr++;
-			continue;
-		}
+	return atol(ptr + len);
+}
 
-		/* task comm can contain spaces, so give it special treatment */
-		if (!(ptr = get_taskpid_str(ptr, end, &next))) {
-			ee("failed to parse task-pid field\n");
-			return false;
-		} else if (!parse_task_pid(ptr, next, &trace_comm, &trace_pid)) {
-			ee("malformed 'task-pid' field: '%s'\n", ptr);
-			return false;
-		}
+/* data format:
+ * comm=<comm> pid=<pid> prio=<prio> [success=<n>] target_cpu=<cpu>
+ * waker is the task which logged the event unless it was logged in irq
+ * context, in which case the logged task is just the one interrupted
+ */
+static char *parse_sched_wakeup(struct wakeup *w, char *ptr, char *end)
+{
+	char *next;
+	char *eol;
 
-		ptr = next + 1;
+	if (!(eol = (char *) memchr(ptr, '\n', end - ptr)))
+		return nullptr;
+	else if (!get_comm_str(ptr, eol, &next, " pid="))
+		return nullptr;
+	else if (!(ptr = strchr(next + 1, '=')))
+		return nullptr;
 
-		if (!(ptr = get_data_field(ptr, end, &next)))
-			return false;
+	uint32_t pid = atoi(++ptr);
+	long cpu = get_key_value(ptr, eol, "target_cpu=", 11);
 
-		trace_cpu = atoi(ptr + 1); /* skip leading '[' */
-		ptr = next + 1;
+	w->cpu = cpu < 0 ? 0 : cpu;
 
-		/* skip flags */
-		if (!(ptr = get_data_field(ptr, end, &next)))
-			return false;
+	plot_.wakeups[pid].push_back(*w);
+	return eol;
+}
 
-		ptr = next + 1;
+/* data format:
+ * irq_handler_entry: irq=<nr> name=<name>
+ * irq_handler_exit: irq=<nr> ret=<ret>
+ * softirq_entry: vec=<nr> [action=<name>]
+ * softirq_exit: vec=<nr> [action=<name>]
+ * exits without matching entry, e.g. at trace start, are dropped
+ */
+static char *parse_irq(enum trace_type type, uint32_t cpu, double ts,
+ char *ptr, char *end)
+{
+	bool soft = type == TRACE_SOFTIRQ_ENTRY || type == TRACE_SOFTIRQ_EXIT;
+	char *eol;
+	long nr;
 
-		/* handle timestamp */
-		if (!(ptr = get_data_field(ptr, end, &next)))
-			return false;
+	if (!(eol = (char *) memchr(ptr, '\n', end - ptr)))
+		return nullptr;
+	else if ((nr = get_key_value(ptr, eol, soft ? "vec=" : "irq=", 4)) < 0)
+		return eol;
+
+	if (plot_.irqs.size() <= cpu)
+		plot_.irqs.resize(cpu + 1);
+
+	struct cpu_irqs *irqs = &plot_.irqs[cpu];
+	struct irq_span *entry = soft ? &irqs->soft_entry : &irqs->hard_entry;
+
+	if (type == TRACE_IRQ_ENTRY || type == TRACE_SOFTIRQ_ENTRY) {
+		entry->start = ts;
+		entry->nr = nr;
+	} else if (entry->start >= 0 && entry->nr == nr) {
+		entry->stop = ts;
+		(soft ? irqs->soft : irqs->hard).push_back(*entry);
+		entry->start = -1;
+	}
 
-		trace_ts = atof(ptr);
-		ptr = next + 1;
+	return eol;
+}
 
-		/* handle function */
-		if (!(ptr = get_data_field(ptr, end, &next)))
-			return false;
+/* data format:
+ * cpu_frequency: state=<khz> cpu_id=<cpu>
+ * cpu_idle: state=<idle state, (u32) -1 on exit> cpu_id=<cpu>
+ * every cpu gets a lane per event in MHz or idle state + 1, 0 means busy
+ */
+static char *parse_power(struct plot_data *data, enum trace_type type,
+ char *ptr, char *end)
+{
+	static char label[32];
+	char *eol;
 
-		if (strcmp("tracing_mark_write:", ptr) == 0) {
-			type = TRACE_MARKER;
-		} else if (strcmp("sched_switch:", ptr) == 0) {
-			type = TRACE_SCHED_SWITCH;
-		} else if (strcmp("sched_task_info:", ptr) == 0) {
-			type = TRACE_SCHED_TASK_STAT;
-		} else if (strcmp("sched_task_stat:", ptr) == 0) {
-			type = TRACE_SCHED_TASK_STAT;
-		} else { /* not supported */
-			if (!(ptr = (char *) memchr(ptr, '\n', end - ptr))) {
-				ee("malformed string '%s'\n", ptr);
-				return false;
-			}
+	if (!(eol = (char *) memchr(ptr, '\n', end - ptr)))
+		return nullptr;
 
-			ptr++;
-			continue;
-		}
+	long state = get_key_value(ptr, eol, "state=", 6);
+	long cpu = get_key_value(ptr, eol, "cpu_id=", 7);
 
-		ptr = next + 1;
+	if (state < 0 || cpu < 0)
+		return eol;
 
-		if (!plot_.min_ts)
-			plot_.min_ts = trace_ts;
+	if (type == TRACE_CPU_FREQUENCY) {
+		snprintf(label, sizeof(label), "cpu%ld MHz", cpu);
+		data->value = state / 1e3;
 
-		/* start task info fields */
+		if (plot_.freqs.size() <= (size_t) cpu)
+			plot_.freqs.resize(cpu + 1);
 
-		struct plot_data data[2];
-		data[0].comm = nullptr;
-		data[1].comm = nullptr;
-		data[0].ts = trace_ts;
-		data[1].ts = trace_ts;
+		plot_.freqs[cpu].push_back({ data->ts - plot_.min_ts,
+		 (uint32_t) state });
+		if (plot_.max_khz < state)
+			plot_.max_khz = state;
+	} else {
+		snprintf(label, sizeof(label), "cpu%ld idle", cpu);
+		data->value = (uint32_t) state == UINT32_MAX ? 0 : state + 1;
+	}
 
-		struct plot_data *data0 = &data[0];
+	data->comm = "power";
+	data->pid = 0;
+	data->monitor = true;
+	data->power = true;
+	data->label = label;
+	return eol;
+}
 
-		if (type == TRACE_MARKER) {
-			data[0].comm = trace_comm;
-			data[0].pid = trace_pid;
+/* integral of cpu frequency over [start, stop] in kHz * s; frequency before
+ * the first step on cpu is assumed to be the first known one
+ */
+static double get_freq_time(uint16_t cpu, double start, double stop)
+{
+	if (cpu >= plot_.freqs.size() || plot_.freqs[cpu].empty())
+		return 0;
+
+	std::vector<struct freq_step> *v = &plot_.freqs[cpu];
+	auto it = std::upper_bound(v->begin(), v->end(), start,
+	 [](double x, const struct freq_step &f) { return x < f.ts; });
+
+	if (it != v->begin())
+		it--;
+
+	double sum = 0;
+	for (; it != v->end() && it->ts < stop; ++it) {
+		double a = std::max(it->ts, start);
+		double b = (it + 1 != v->end()) ? std::min((it + 1)->ts, stop) :
+		 stop;
+
+		if (it == v->begin())
+			a = start;
+		if (b > a)
+			sum += it->khz * (b - a);
+	}
 
-			if (!(ptr = parse_marker(&data[0], ptr, end))) {
-				return false;
-			} else if (data[0].marker) {
-				data[0].monitor = is_monitor(data[0].marker);
-				data[0].gpu = is_gpu(data[0].marker);
+	return sum;
+}
 
-				if (data[0].gpu)
-					data[0].comm = "gpu";
-			}
-		} else if (type == TRACE_SCHED_TASK_STAT) {
-			if (!(ptr = parse_task_stat(&data[0], ptr, end)))
-				return false;
-		} else if (type == TRACE_SCHED_SWITCH) {
-			if (!(ptr = parse_sched_switch(data, ptr, end)))
-				return false;
-		}
+/* data format:
+ * comm=<comm> pid=<pid> prio=<prio> orig_cpu=<cpu> dest_cpu=<cpu>
+ */
+static char *parse_sched_migrate(double ts, char *ptr, char *end)
+{
+	char *next;
+	char *eol;
 
-		for (uint8_t i = 0; i < 2; ++i) {
-			if (!data[i].comm)
-				continue;
+	if (!(eol = (char *) memchr(ptr, '\n', end - ptr)))
+		return nullptr;
+	else if (!get_comm_str(ptr, eol, &next, " pid="))
+		return nullptr;
+	else if (!(ptr = strchr(next + 1, '=')))
+		return nullptr;
 
-			data[i].cpu = trace_cpu;
-			data[i].ts = trace_ts - plot_.min_ts;
-			update_y_axis(data[i].comm, &data[i]);
+	uint32_t pid = atoi(++ptr);
+	long from = get_key_value(ptr, eol, "orig_cpu=", 9);
+	long to = get_key_value(ptr, eol, "dest_cpu=", 9);
 
-			if (type == TRACE_MARKER && !data[i].monitor &&
-			 !data[i].gpu) {
-				update_y_markers(&data[i], trace_pid);
-#if 0
-				printf("[%u] %f %u %u %u '%s' | '%s' | %f\n",
-				 data[i].id, data[i].ts, data[i].pid,
-				 data[i].arrived, data[i].cpu, data[i].comm,
-				 data[i].marker, data[i].raw_ts);
-#endif
-			} else {
-#if 0
-				printf("[%u] %f %u %u %u '%s' | '%s' | %f\n",
-				 data[i].id, data[i].ts, data[i].pid,
-				 data[i].arrived, data[i].cpu, data[i].comm,
-				 data[i].marker, data[i].raw_ts);
-#endif
-				add_data_point(&data[i]);
-				plot_.plot_data.push_back(std::move(data[i]));
-			}
-		}
+	if (from < 0 || to < 0 || from == to)
+		return eol;
 
-		ptr++;
-	}
+	plot_.migrations[pid].push_back({ ts, (uint16_t) from, (uint16_t) to });
+	plot_.has_migrate = true;
+	return eol;
+}
+
+/* lanes are independent in post-processing passes, so they run in
+ * parallel; fn must only touch the lane it is given, paged out points it
+ * read are dropped right after
+ */
+static inline void for_each_axis(const std::function<void(struct y_axis *)> &fn)
+{
+	parallel_for(plot_.y_axes.size(), [&](size_t i) {
+		fn(&plot_.y_axes[i]);
+		drop_array(&plot_.y_axes[i].points);
+	});
+}
+
+static void update_jank(void)
+{
+	for_each_axis([](struct y_axis *axis) {
+		struct frame_stats *stats = &axis->frame_stats;
+		double target = plot_.target_ms > 0 ? plot_.target_ms : stats->p50;
+		double jank = target * plot_.jank_factor;
+
+		if (!axis->frame)
+			return;
+
+		stats->jank = 0;
+		for (auto &point : axis->points)
+			stats->jank += (point.xx >= 0 && point.y > jank);
+	});
+}
+
+static inline double get_percentile(std::vector<double> &v, double p)
+{
+	size_t i = ceil(p * v.size());
+	return v[i ? i - 1 : 0];
+}
+
+/* data format: present,<frame>,<id>
+ * every present closes the interval started by previous one, interval in
+ * ms is kept in point.y and its end in point.xx
+ */
+static void init_frames(void)
+{
+	for_each_axis([](struct y_axis *axis) {
+		struct frame_stats *stats = &axis->frame_stats;
+		std::vector<double> times;
+
+		if (!axis->frame)
+			return;
+
+		for (size_t i = 0; i + 1 < axis->points.size(); ++i) {
+			struct point *point = &axis->points[i];
+			point->xx = axis->points[i + 1].x;
+			point->y = (point->xx - point->x) * 1e3;
+			times.push_back(point->y);
+		}
+
+		if (times.empty())
+			return;
+
+		std::sort(times.begin(), times.end());
+		stats->count = times.size();
+		stats->p50 = get_percentile(times, .5);
+		stats->p90 = get_percentile(times, .9);
+		stats->p99 = get_percentile(times, .99);
+		stats->max = times.back();
+		axis->max_y = stats->max;
+	});
+
+	for (auto &axis : plot_.y_axes) {
+		struct frame_stats *stats = &axis.frame_stats;
+
+		if (!axis.frame || !stats->count)
+			continue;
+
+		ii("%s: %u frames p50 %.2f p90 %.2f p99 %.2f max %.2f ms\n",
+		 axis.name.c_str(), stats->count, stats->p50, stats->p90,
+		 stats->p99, stats->max);
+	}
+
+	update_jank();
+}
+
+/* drop unpaired submits and jobs, e.g. from trace edges or ids reused by
+ * another process
+ */
+static void init_flows(void)
+{
+	std::vector<struct flow> flows;
+	std::vector<uint32_t> kept;
+	std::vector<uint32_t> remap(plot_.flows.size(), UINT32_MAX);
+
+	for (uint32_t i = 0; i < plot_.flows.size(); ++i) {
+		struct flow *flow = &plot_.flows[i];
+
+		if (flow->submit_ts < 0 || flow->start_ts < 0)
+			continue;
+		else if (flow->pid != flow->job_pid)
+			continue;
+
+		double lag = fabs(flow->start_ts - flow->submit_ts);
+		if (plot_.max_flow_lag < lag)
+			plot_.max_flow_lag = lag;
+
+		kept.push_back(i);
+	}
+
+	std::sort(kept.begin(), kept.end(), [](uint32_t a, uint32_t b) {
+		return plot_.flows[a].submit_ts < plot_.flows[b].submit_ts;
+	});
+
+	for (uint32_t i : kept) {
+		remap[i] = flows.size();
+		flows.push_back(plot_.flows[i]);
+	}
+
+	/* jobs point to their flows at load time indices */
+	for (auto &axis : plot_.y_axes) {
+		if (!axis.gpu)
+			continue;
+
+		for (auto &point : axis.points) {
+			if (point.flow != UINT32_MAX)
+				point.flow = remap[point.flow];
+		}
+	}
+
+	plot_.flows.swap(flows);
+	std::unordered_map<int32_t, size_t>().swap(plot_.flow_ids);
+
+	if (plot_.flows.size()) {
+		ii("%zu submit flows, max lag %f\n", plot_.flows.size(),
+		 plot_.max_flow_lag);
+	}
+}
+
+/* sched_waking is closer to the actual cause, so when trace has both
+ * events keep only wakings; edges are in trace order already
+ */
+static void init_wakeups(void)
+{
+	std::vector<std::vector<struct wakeup> *> tasks;
+	size_t edges = 0;
+
+	for (auto &it : plot_.wakeups)
+		tasks.push_back(&it.second);
+
+	if (plot_.has_waking) {
+		parallel_for(tasks.size(), [&](size_t i) {
+			std::vector<struct wakeup> *v = tasks[i];
+
+			v->erase(std::remove_if(v->begin(), v->end(),
+			 [](const struct wakeup &w) { return !w.waking; }),
+			 v->end());
+		});
+	}
+
+	for (auto *v : tasks)
+		edges += v->size();
+
+	if (edges) {
+		ii("wakeup graph: %zu edges, %zu tasks\n", edges,
+		 plot_.wakeups.size());
+	}
+}
+
+/* run time by cpu and migrations per task; migrations come from
+ * sched_migrate_task if trace has it, otherwise from cpu changes between
+ * run slices, which misses migrations of tasks that haven't run yet
+ */
+static void init_residency(void)
+{
+	size_t total = 0;
+
+	/* task lanes have unique pids, so each one moves its own migrations */
+	for_each_axis([](struct y_axis *axis) {
+		if (axis->gpu || axis->monitor || axis->frame || !axis->pid)
+			return;
+
+		int32_t prev_cpu = -1;
+		double first = -1;
+		double last = -1;
+
+		axis->run_time = 0;
+		axis->cpu_time.clear();
+		axis->migrations.clear();
+
+		for (size_t i = 0; i + 1 < axis->points.size(); ++i) {
+			struct point *point = &axis->points[i];
+			double stop = axis->points[i + 1].x;
+
+			if (!point->arrived || point->x < 0 || stop <= point->x)
+				continue;
+
+			if (axis->cpu_time.size() <= point->cpu)
+				axis->cpu_time.resize(point->cpu + 1);
+
+			axis->cpu_time[point->cpu] += stop - point->x;
+			axis->run_time += stop - point->x;
+
+			if (!plot_.has_migrate && prev_cpu >= 0 &&
+			 prev_cpu != point->cpu) {
+				axis->migrations.push_back({ point->x,
+				 (uint16_t) prev_cpu, point->cpu });
+			}
+
+			prev_cpu = point->cpu;
+			if (first < 0)
+				first = point->x;
+			last = stop;
+		}
+
+		auto it = plot_.migrations.find(axis->pid);
+		if (it != plot_.migrations.end())
+			axis->migrations = std::move(it->second);
+
+		if (last > first && first >= 0) {
+			axis->migration_rate = axis->migrations.size() /
+			 (last - first);
+		}
+	});
+
+	for (auto &axis : plot_.y_axes)
+		total += axis.migrations.size();
+
+	std::unordered_map<uint32_t, std::vector<struct migration>>().swap(
+	 plot_.migrations);
+
+	ii("migrations: %zu from %s\n", total, plot_.has_migrate ?
+	 "sched_migrate_task" : "cpu changes");
+}
+
+/* frequency-weighted run time tells how much work task could do, as if
+ * it ran at max frequency all the time
+ */
+static void init_power(void)
+{
+	if (!plot_.max_khz)
+		return;
+
+	for_each_axis([](struct y_axis *axis) {
+		if (axis->gpu || axis->monitor || axis->frame)
+			return;
+
+		axis->work_time = 0;
+
+		for (size_t i = 0; i + 1 < axis->points.size(); ++i) {
+			struct point *point = &axis->points[i];
+			double stop = axis->points[i + 1].x;
+
+			if (!point->arrived || point->x < 0 || stop <= point->x)
+				continue;
+
+			axis->work_time += get_freq_time(point->cpu, point->x,
+			 stop) / plot_.max_khz;
+		}
+	});
+
+	ii("power: %zu cpus, max %u MHz\n", plot_.freqs.size(),
+	 plot_.max_khz / 1000);
+}
+
+/* under memory budget slices are read back from mapping and the index goes
+ * there too once built; on failure lane is left without index
+ */
+static void build_run_index(struct run_index *idx)
+{
+	size_t n = idx->start.size();
+
+	if (!page_arrays(&idx->start, &idx->stop)) {
+		*idx = run_index{};
+		return;
+	}
+
+	idx->cum.resize(n + 1);
+	idx->max.resize(n * 2);
+	idx->cum[0] = 0;
+
+	for (size_t i = 0; i < n; ++i) {
+		double len = idx->stop[i] - idx->start[i];
+		idx->cum[i + 1] = idx->cum[i] + len;
+		idx->max[n + i] = len;
+	}
+
+	for (size_t i = n - 1; i > 0; --i)
+		idx->max[i] = std::max(idx->max[i * 2], idx->max[i * 2 + 1]);
+
+	if (!page_arrays(&idx->cum, &idx->max))
+		*idx = run_index{};
+
+	drop_array(&idx->start);
+	drop_array(&idx->stop);
+}
+
+/* one pass over points per task; cpus get slices of all tasks but idle,
+ * gathered in lane order, so they don't depend on number of threads
+ */
+static void init_run_index(void)
+{
+	std::vector<std::vector<std::pair<double, double>>> cpus;
+	std::vector<std::vector<uint16_t>> slice_cpus(plot_.y_axes.size());
+	size_t slices = 0;
+
+	parallel_for(plot_.y_axes.size(), [&](size_t a) {
+		struct y_axis *axis = &plot_.y_axes[a];
+		struct run_index *idx = &axis->run_index;
+
+		if (axis->gpu || axis->monitor || axis->frame)
+			return;
+
+		for (size_t i = 0; i + 1 < axis->points.size(); ++i) {
+			struct point *point = &axis->points[i];
+			double stop = axis->points[i + 1].x;
+
+			if (!point->arrived || point->x < 0 || stop <= point->x)
+				continue;
+
+			idx->start.push_back(point->x);
+			idx->stop.push_back(stop);
+			slice_cpus[a].push_back(point->cpu);
+		}
+
+		drop_array(&axis->points);
+		if (idx->start.size())
+			build_run_index(idx);
+	});
+
+	for (size_t a = 0; a < plot_.y_axes.size(); ++a) {
+		struct run_index *idx = &plot_.y_axes[a].run_index;
+
+		slices += idx->start.size();
+		if (!plot_.y_axes[a].pid)
+			continue;
+
+		for (size_t i = 0; i < idx->start.size(); ++i) {
+			uint16_t cpu = slice_cpus[a][i];
+
+			if (cpus.size() <= cpu)
+				cpus.resize(cpu + 1);
+
+			cpus[cpu].push_back({ idx->start[i], idx->stop[i] });
+		}
+	}
+
+	plot_.cpu_index.resize(cpus.size());
+
+	parallel_for(cpus.size(), [&](size_t cpu) {
+		struct run_index *idx = &plot_.cpu_index[cpu];
+
+		std::sort(cpus[cpu].begin(), cpus[cpu].end());
+		for (auto &slice : cpus[cpu]) {
+			idx->start.push_back(slice.first);
+			idx->stop.push_back(slice.second);
+		}
+
+		if (idx->start.size())
+			build_run_index(idx);
+	});
+
+	ii("run index: %zu slices, %zu cpus\n", slices, cpus.size());
+}
+
+/* longest slice in [i0, i1] */
+static float get_range_max(struct run_index *idx, size_t i0, size_t i1)
+{
+	size_t n = idx->start.size();
+	float max = 0;
+
+	for (i0 += n, i1 += n + 1; i0 < i1; i0 /= 2, i1 /= 2) {
+		if (i0 & 1)
+			max = std::max(max, idx->max[i0++]);
+		if (i1 & 1)
+			max = std::max(max, idx->max[--i1]);
+	}
+
+	return max;
+}
+
+/* run time within [t0, t1] with two binary searches; slices which overlap
+ * the range are [*i0, *i1], none if *i0 > *i1
+ */
+static double get_range_run(struct run_index *idx, double t0, double t1,
+ size_t *i0, size_t *i1)
+{
+	*i0 = std::upper_bound(idx->stop.begin(), idx->stop.end(), t0) -
+	 idx->stop.begin();
+	*i1 = std::lower_bound(idx->start.begin(), idx->start.end(), t1) -
+	 idx->start.begin();
+
+	if (*i1 <= *i0) {
+		*i0 = 1;
+		*i1 = 0;
+		return 0;
+	}
+
+	(*i1)--;
+
+	double run = idx->cum[*i1 + 1] - idx->cum[*i0];
+	if (idx->start[*i0] < t0)
+		run -= t0 - idx->start[*i0];
+	if (idx->stop[*i1] > t1)
+		run -= idx->stop[*i1] - t1;
+
+	return run;
+}
+
+/* share of [t0, t1] task or cpu was running */
+static inline double get_utilization(struct run_index *idx, double t0,
+ double t1)
+{
+	size_t i0;
+	size_t i1;
+
+	if (idx->start.empty() || t1 <= t0)
+		return 0;
+
+	return get_range_run(idx, t0, t1, &i0, &i1) / (t1 - t0);
+}
+
+/* run time before t; k is slice cursor, t must not decrease between calls */
+static inline double get_run_before(struct run_index *idx, double t,
+ size_t *k)
+{
+	size_t n = idx->start.size();
+
+	while (*k < n && idx->stop[*k] <= t)
+		(*k)++;
+
+	if (*k == n)
+		return idx->cum[n];
+
+	return idx->cum[*k] + std::max(0., t - idx->start[*k]);
+}
+
+static void update_range_stats(void)
+{
+	double t0 = plot_.range_min;
+	double t1 = plot_.range_max;
+	size_t i0;
+	size_t i1;
+
+	plot_.range_stats.clear();
+	plot_.range_cpus.clear();
+
+	for (size_t n = 0; n < plot_.y_axes.size(); ++n) {
+		struct run_index *idx = &plot_.y_axes[n].run_index;
+		struct range_stats stats;
+
+		if (!plot_.y_axes[n].pid || idx->start.empty())
+			continue;
+
+		stats.run = get_range_run(idx, t0, t1, &i0, &i1);
+		if (i0 > i1)
+			continue;
+
+		/* end slices are clipped by range, inner ones are not */
+		stats.axis = n;
+		stats.slices = i1 - i0 + 1;
+		stats.max = std::min(idx->stop[i0], t1) -
+		 std::max(idx->start[i0], t0);
+		stats.max = std::max(stats.max, std::min(idx->stop[i1], t1) -
+		 std::max(idx->start[i1], t0));
+		if (i1 > i0 + 1)
+			stats.max = std::max(stats.max,
+			 (double) get_range_max(idx, i0 + 1, i1 - 1));
+
+		plot_.range_stats.push_back(stats);
+	}
+
+	std::sort(plot_.range_stats.begin(), plot_.range_stats.end(),
+	 [](const struct range_stats &a, const struct range_stats &b) {
+		return a.run > b.run;
+	});
+
+	for (auto &idx : plot_.cpu_index) {
+		plot_.range_cpus.push_back(idx.start.empty() ? 0 :
+		 get_range_run(&idx, t0, t1, &i0, &i1));
+	}
+}
+
+/* async spans can overlap, so they are packed into rows below B/E depths,
+ * each row taking spans which start after its last one stops
+ */
+static void init_async(void)
+{
+	std::vector<size_t> base(plot_.y_axes.size());
+
+	for (size_t i = 0; i < plot_.y_axes.size(); ++i)
+		base[i] = plot_.y_axes[i].spans.size();
+
+	std::sort(plot_.async_spans.begin(), plot_.async_spans.end(),
+	 [](const struct async_span &a, const struct async_span &b) {
+		return a.span.start < b.span.start;
+	});
+
+	for (auto &async : plot_.async_spans) {
+		std::vector<std::vector<struct span>> *rows;
+		size_t d;
+
+		rows = &plot_.y_axes[async.id].spans;
+		for (d = base[async.id]; d < rows->size(); ++d) {
+			if ((*rows)[d].back().stop <= async.span.start)
+				break;
+		}
+
+		if (d == rows->size())
+			rows->resize(d + 1);
+
+		(*rows)[d].push_back(async.span);
+	}
+
+	if (plot_.async_spans.size()) {
+		ii("async spans: %zu, %zu unfinished\n",
+		 plot_.async_spans.size(), plot_.async_open.size());
+	}
+
+	std::vector<struct async_span>().swap(plot_.async_spans);
+	std::unordered_map<std::string, struct async_span>().swap(
+	 plot_.async_open);
+}
+
+/* spans left open at the end of trace are dropped */
+static void init_spans(void)
+{
+	std::unordered_map<std::string_view, std::vector<float>> durations;
+	size_t count = 0;
+
+	init_async();
+
+	for (auto &axis : plot_.y_axes) {
+		for (auto &depth : axis.spans) {
+			for (auto &span : depth)
+				durations[span.name].push_back(span.stop - span.start);
+
+			count += depth.size();
+		}
+	}
+
+	std::vector<std::pair<const char *, std::vector<float> *>> names;
+
+	for (auto &it : durations)
+		names.push_back({ it.first.data(), &it.second });
+
+	plot_.span_stats.resize(names.size());
+
+	parallel_for(names.size(), [&](size_t i) {
+		std::vector<float> *v = names[i].second;
+		struct span_stats *stats = &plot_.span_stats[i];
+		size_t p99 = v->size() * .99;
+		double total = 0;
+
+		for (float d : *v)
+			total += d;
+
+		std::nth_element(v->begin(), v->begin() + p99, v->end());
+		stats->name = names[i].first;
+		stats->count = v->size();
+		stats->p99 = (*v)[p99] * 1e3;
+		stats->max = *std::max_element(v->begin(), v->end()) * 1e3;
+		stats->total = total * 1e3;
+		stats->mean = stats->total / stats->count;
+	});
+
+	std::sort(plot_.span_stats.begin(), plot_.span_stats.end(),
+	 [](const struct span_stats &a, const struct span_stats &b) {
+		return a.total > b.total;
+	});
+
+	std::unordered_map<uint32_t, std::vector<struct span>>().swap(
+	 plot_.span_stacks);
+
+	if (count)
+		ii("spans: %zu, %zu names\n", count, plot_.span_stats.size());
+}
+
+static void add_m4_sample(struct y_axis *axis, struct m4_bucket *b,
+ uint32_t i)
+{
+	if (b->first == UINT32_MAX) {
+		*b = { i, i, i, i };
+		return;
+	}
+
+	if (axis->points[i].y < axis->points[b->min].y)
+		b->min = i;
+	if (axis->points[i].y > axis->points[b->max].y)
+		b->max = i;
+
+	b->last = i;
+}
+
+static struct m4_bucket merge_m4(struct y_axis *axis, struct m4_bucket *a,
+ struct m4_bucket *b)
+{
+	struct m4_bucket m = *a;
+
+	if (a->first == UINT32_MAX)
+		return *b;
+	else if (b->first == UINT32_MAX)
+		return *a;
+
+	if (axis->points[b->min].y < axis->points[m.min].y)
+		m.min = b->min;
+	if (axis->points[b->max].y > axis->points[m.max].y)
+		m.max = b->max;
+
+	m.last = b->last;
+	return m;
+}
+
+/* first, min, max and last samples of bucket in time order without repeats */
+static uint8_t get_m4_samples(struct m4_bucket *b, uint32_t v[4])
+{
+	if (b->first == UINT32_MAX)
+		return 0;
+
+	v[0] = b->first;
+	v[1] = b->min;
+	v[2] = b->max;
+	v[3] = b->last;
+
+	std::sort(v, v + 4);
+	return std::unique(v, v + 4) - v;
+}
+
+/* level 0 buckets hold two samples on average, so pixel wide buckets are
+ * at most twice that and never less than half a pixel wide
+ */
+static void build_m4(struct y_axis *axis)
+{
+	struct point_array *points = &axis->points;
+	double span = points->back().x - points->front().x;
+	std::vector<struct m4_bucket> *level;
+
+	if (span <= 0)
+		return;
+
+	axis->m4_width = span / (points->size() - 1) * 2;
+	axis->m4_origin = points->front().x;
+	axis->m4.resize(1);
+	level = &axis->m4[0];
+	level->resize(span / axis->m4_width + 1, { UINT32_MAX, 0, 0, 0 });
+
+	for (uint32_t i = 0; i < points->size(); ++i) {
+		double x = (*points)[i].x - axis->m4_origin;
+		add_m4_sample(axis, &(*level)[x / axis->m4_width], i);
+	}
+
+	while (axis->m4.back().size() > 1) {
+		std::vector<struct m4_bucket> next;
+		std::vector<struct m4_bucket> *prev = &axis->m4.back();
+
+		next.reserve(prev->size() / 2 + 1);
+		for (size_t j = 0; j < prev->size(); j += 2) {
+			if (j + 1 == prev->size())
+				next.push_back((*prev)[j]);
+			else
+				next.push_back(merge_m4(axis, &(*prev)[j],
+				 &(*prev)[j + 1]));
+		}
+
+		axis->m4.push_back(std::move(next));
+	}
+}
+
+/* m4 levels from m4_pinned_level_ up as samples, so zoomed out monitor
+ * lanes don't read paged out points; finer levels are dropped
+ */
+static void pin_m4(struct y_axis *axis)
+{
+	for (size_t k = m4_pinned_level_; k < axis->m4.size(); ++k) {
+		std::vector<ImPlotPoint> samples;
+
+		for (auto &b : axis->m4[k]) {
+			uint32_t v[4];
+			uint8_t count = get_m4_samples(&b, v);
+
+			for (uint8_t n = 0; n < count; ++n) {
+				struct point *point = &axis->points[v[n]];
+				samples.push_back(ImPlotPoint(point->x, point->y));
+			}
+		}
+
+		axis->m4_base = m4_pinned_level_;
+		axis->m4_samples.push_back(std::move(samples));
+	}
+
+	std::vector<std::vector<struct m4_bucket>>().swap(axis->m4);
+}
+
+/* paged out lanes keep only coarse levels, they are pinned right away so
+ * that full pyramids of all lanes never exist at once
+ */
+static void init_m4(void)
+{
+	size_t axes = 0;
+
+	for_each_axis([](struct y_axis *axis) {
+		if (!axis->monitor || axis->power ||
+		 axis->points.size() < min_m4_points_)
+			return;
+
+		build_m4(axis);
+		if (axis->points.map)
+			pin_m4(axis);
+	});
+
+	for (auto &axis : plot_.y_axes)
+		axes += axis.m4.size() || axis.m4_samples.size();
+
+	if (axes)
+		ii("m4: %zu monitor lanes\n", axes);
+}
+
+static void init_irqs(void)
+{
+	size_t hard = 0;
+	size_t soft = 0;
+
+	for (auto &irqs : plot_.irqs) {
+		hard += irqs.hard.size();
+		soft += irqs.soft.size();
+	}
+
+	if (hard || soft)
+		ii("irqs: %zu hard, %zu soft\n", hard, soft);
+}
+
+/* common fields of trace line and records parsed from its payload */
+struct trace_event {
+	char *comm;
+	uint32_t pid;
+	uint32_t cpu;
+	double ts;
+	bool irq; /* logged in hardirq or softirq context */
+	enum trace_type type;
+	struct plot_data data[2]; /* e.g. prev and next tasks of a switch */
+};
+
+typedef char *(*event_parser)(struct trace_event *ev, char *ptr, char *end);
+
+struct event_handler {
+	const char *name; /* function token including ':' */
+	uint8_t len;
+	enum trace_type type;
+	event_parser parse;
+};
+
+/* name length is known at compile time */
+#define EVENT_HANDLER(name, type, parse) \
+	{ name, sizeof(name) - 1, type, parse }
+
+/* counter goes to a monitor lane of <pid> named after the counter; label is
+ * cut out of marker in place
+ */
+static void parse_counter(struct plot_data *data)
+{
+	char *ptr = data->marker + 2; /* skip 'C|' */
+	char *tmp;
+	uint32_t pid = strtoul(ptr, &tmp, 10);
+
+	if (tmp == ptr || *tmp != '|')
+		return;
+
+	ptr = tmp + 1;
+	if (!(tmp = strrchr(ptr, '|')) || tmp == ptr)
+		return;
+
+	*tmp = '\0';
+	data->pid = pid;
+	data->label = ptr;
+	data->value = atof(tmp + 1);
+	data->monitor = true;
+	data->counter = true;
+}
+
+static char *handle_marker(struct trace_event *ev, char *ptr, char *end)
+{
+	struct plot_data *data = &ev->data[0];
+
+	data->comm = ev->comm;
+	data->pid = ev->pid;
+
+	if (!(ptr = parse_marker(data, ptr, end)))
+		return nullptr;
+	else if (!data->marker)
+		return ptr;
+
+	data->monitor = is_monitor(data->marker);
+	data->gpu = is_gpu(data->marker);
+	data->frame = is_frame(data->marker);
+	data->span = is_span(data->marker);
+	data->async = is_async(data->marker);
+
+	if (is_counter(data->marker))
+		parse_counter(data);
+	else if (data->gpu)
+		data->comm = "gpu";
+
+	return ptr;
+}
+
+static char *handle_task_stat(struct trace_event *ev, char *ptr, char *end)
+{
+	return parse_task_stat(&ev->data[0], ptr, end);
+}
+
+static char *handle_sched_switch(struct trace_event *ev, char *ptr, char *end)
+{
+	return parse_sched_switch(ev->data, ptr, end);
+}
+
+static char *handle_sched_wakeup(struct trace_event *ev, char *ptr, char *end)
+{
+	struct wakeup w;
+
+	w.ts = ev->ts - plot_.min_ts;
+	w.waker = ev->irq ? 0 : ev->pid;
+	w.waking = ev->type == TRACE_SCHED_WAKING;
+	plot_.has_waking |= w.waking;
+
+	return parse_sched_wakeup(&w, ptr, end);
+}
+
+static char *handle_power(struct trace_event *ev, char *ptr, char *end)
+{
+	return parse_power(&ev->data[0], ev->type, ptr, end);
+}
+
+static char *handle_sched_migrate(struct trace_event *ev, char *ptr,
+ char *end)
+{
+	return parse_sched_migrate(ev->ts - plot_.min_ts, ptr, end);
+}
+
+static char *handle_irq(struct trace_event *ev, char *ptr, char *end)
+{
+	return parse_irq(ev->type, ev->cpu, ev->ts - plot_.min_ts, ptr, end);
+}
+
+/* new events only need an entry here */
+static const struct event_handler event_handlers_[] = {
+	EVENT_HANDLER("tracing_mark_write:", TRACE_MARKER, handle_marker),
+	EVENT_HANDLER("sched_switch:", TRACE_SCHED_SWITCH, handle_sched_switch),
+	EVENT_HANDLER("sched_task_info:", TRACE_SCHED_TASK_STAT,
+	 handle_task_stat),
+	EVENT_HANDLER("sched_task_stat:", TRACE_SCHED_TASK_STAT,
+	 handle_task_stat),
+	EVENT_HANDLER("sched_wakeup:", TRACE_SCHED_WAKEUP, handle_sched_wakeup),
+	EVENT_HANDLER("sched_waking:", TRACE_SCHED_WAKING, handle_sched_wakeup),
+	EVENT_HANDLER("irq_handler_entry:", TRACE_IRQ_ENTRY, handle_irq),
+	EVENT_HANDLER("irq_handler_exit:", TRACE_IRQ_EXIT, handle_irq),
+	EVENT_HANDLER("softirq_entry:", TRACE_SOFTIRQ_ENTRY, handle_irq),
+	EVENT_HANDLER("softirq_exit:", TRACE_SOFTIRQ_EXIT, handle_irq),
+	EVENT_HANDLER("cpu_frequency:", TRACE_CPU_FREQUENCY, handle_power),
+	EVENT_HANDLER("cpu_idle:", TRACE_CPU_IDLE, handle_power),
+	EVENT_HANDLER("sched_migrate_task:", TRACE_SCHED_MIGRATE,
+	 handle_sched_migrate),
+};
+
+constexpr uint8_t event_slots_ = 64; /* power of two, sparse enough */
+static const struct event_handler *event_table_[event_slots_];
+
+/* open addressing with linear probing */
+static void init_event_table(void)
+{
+	static bool ready;
+
+	static_assert(ARRAY_SIZE(event_handlers_) < event_slots_ / 2,
+	 "event table is too dense");
+
+	if (ready)
+		return;
+
+	ready = true;
+	for (auto &h : event_handlers_) {
+		uint32_t i = hash_str(h.name, h.len);
+		while (event_table_[i & (event_slots_ - 1)])
+			i++;
+
+		event_table_[i & (event_slots_ - 1)] = &h;
+	}
+}
+
+static inline const struct event_handler *get_event_handler(
+ const char *name, size_t len)
+{
+	uint32_t i = hash_str(name, len);
+	const struct event_handler *h;
+
+	while ((h = event_table_[i++ & (event_slots_ - 1)])) {
+		if (h->len == len && memcmp(h->name, name, len) == 0)
+			return h;
+	}
+
+	return nullptr;
+}
+
+/* lanes streamed to temporary file are put together and mapped, so passes
+ * after parsing read points in place
+ */
+static bool page_points(void)
+{
+	std::vector<size_t> offsets(plot_.y_axes.size());
+
+	if (pages_.fd < 0)
+		return true;
+
+	for (size_t a = 0; a < plot_.y_axes.size(); ++a) {
+		offsets[a] = pack_array(&plot_.y_axes[a].points);
+
+		if (offsets[a] == SIZE_MAX) {
+			ee("failed to write points\n");
+			return false;
+		}
+	}
+
+	if (!map_pages()) {
+		ee("failed to map points\n");
+		return false;
+	}
+
+	for (size_t a = 0; a < plot_.y_axes.size(); ++a)
+		map_array(&plot_.y_axes[a].points, offsets[a]);
+
+	return true;
+}
+
+/* whole lines from ptr to end, the parser cuts fields in place */
+static bool parse_lines(char *ptr, char *end)
+{
+	char *next;
+	const struct event_handler *handler;
+	struct trace_event ev;
+	char *trace_comm = nullptr;
+
+	while (ptr < end) {
+		if (*ptr == '#') {
+			ptr = strchr(ptr, '\n');
+			ptr++;
+			continue;
+		}
+
+		/* task comm can contain spaces, so give it special treatment */
+		if (!(ptr = get_taskpid_str(ptr, end, &next))) {
+			ee("failed to parse task-pid field\n");
+			return false;
+		} else if (!parse_task_pid(ptr, next, &trace_comm, &ev.pid)) {
+			ee("malformed 'task-pid' field: '%s'\n", ptr);
+			return false;
+		}
+
+		ptr = next + 1;
+
+		if (!(ptr = get_data_field(ptr, end, &next)))
+			return false;
+
+		ev.cpu = atoi(ptr); /* '[' is cut by get_taskpid_str() */
+		ptr = next + 1;
+
+		/* flags: irqs-off, need-resched, irq context, preempt depth */
+		if (!(ptr = get_data_field(ptr, end, &next)))
+			return false;
+
+		ev.irq = next - ptr > 2 && strchr("hHsZz", ptr[2]);
+		ptr = next + 1;
+
+		/* handle timestamp */
+		if (!(ptr = get_data_field(ptr, end, &next)))
+			return false;
+
+		ev.ts = atof(ptr);
+		ptr = next + 1;
+
+		/* handle function */
+		if (!(ptr = get_data_field(ptr, end, &next)))
+			return false;
+
+		if (!(handler = get_event_handler(ptr, next - ptr))) {
+			/* not supported */
+			if (!(ptr = (char *) memchr(next, '\n', end - next))) {
+				ee("malformed string '%s'\n", ptr);
+				return false;
+			}
+
+			ptr++;
+			continue;
+		}
+
+		ptr = next + 1;
+
+		if (!plot_.min_ts)
+			plot_.min_ts = ev.ts;
+
+		/* start task info fields */
+
+		struct plot_data *data = ev.data;
+		data[0] = plot_data{};
+		data[1] = plot_data{};
+		data[0].ts = ev.ts;
+		data[1].ts = ev.ts;
+		ev.comm = trace_comm;
+		ev.type = handler->type;
+
+		if (!(ptr = handler->parse(&ev, ptr, end)))
+			return false;
+
+		for (uint8_t i = 0; i < 2; ++i) {
+			if (!data[i].comm)
+				continue;
+
+			data[i].cpu = ev.cpu;
+			data[i].ts = ev.ts - plot_.min_ts;
+
+			if (data[i].monitor && !data[i].power &&
+			 !data[i].counter) {
+				add_monitor_points(&data[i]);
+				continue;
+			}
+
+			update_y_axis(data[i].comm, &data[i]);
+
+			if (ev.type == TRACE_MARKER && !data[i].monitor &&
+			 !data[i].gpu && !data[i].frame) {
+				if (data[i].span)
+					add_span(&data[i]);
+				else if (data[i].async)
+					add_async(&data[i]);
+				else
+					update_y_markers(&data[i], ev.pid);
+
+				if (is_submit(data[i].marker))
+					add_flow_submit(&data[i]);
+#if 0
+				printf("[%u] %f %u %u %u '%s' | '%s' | %f\n",
+				 data[i].id, data[i].ts, data[i].pid,
+				 data[i].arrived, data[i].cpu, data[i].comm,
+				 data[i].marker, data[i].raw_ts);
+#endif
+			} else {
+#if 0
+				printf("[%u] %f %u %u %u '%s' | '%s' | %f\n",
+				 data[i].id, data[i].ts, data[i].pid,
+				 data[i].arrived, data[i].cpu, data[i].comm,
+				 data[i].marker, data[i].raw_ts);
+#endif
+				add_data_point(&data[i]);
+				count_data(&data[i]);
+			}
+		}
+
+		ptr++;
+	}
+
+	return true;
+}
+
+/* block at pos extended or cut to the end of line */
+static size_t get_block_size(size_t pos)
+{
+	const char *ptr = plot_.data + pos;
+	size_t left = plot_.file_size - pos;
+	size_t len = std::min(parse_block_, left);
+	const char *eol;
+
+	if (len == left)
+		return len;
+	else if ((eol = (const char *) memrchr(ptr, '\n', len)))
+		return eol + 1 - ptr;
+	else if ((eol = (const char *) memchr(ptr + len, '\n', left - len)))
+		return eol + 1 - ptr;
+
+	return left;
+}
+
+/* trace mapping is read only: every block is parsed from a copy and its
+ * pages are dropped right after, so they never count as process memory
+ */
+static bool init_data(void)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+	std::vector<char> buf;
+
+	init_event_table();
+
+	for (size_t pos = 0, len; pos < plot_.file_size; pos += len) {
+		size_t from = pos & ~(page - 1);
+
+		len = get_block_size(pos);
+		buf.assign(plot_.data + pos, plot_.data + pos + len);
+		buf.push_back('\0');
+
+		if (!parse_lines(buf.data(), buf.data() + len))
+			return false;
+
+		madvise((void *) (plot_.data + from),
+		 ((pos + len) & ~(page - 1)) - from, MADV_DONTNEED);
+	}
+
+	madvise((void *) plot_.data, plot_.file_size, MADV_DONTNEED);
+	std::unordered_set<std::string_view>().swap(plot_.names.names);
+	std::unordered_map<uint64_t, uint16_t>().swap(plot_.axis_ids);
+	plot_.max_x = plot_.data_max - plot_.data_min;
+	printf("max seconds: %f max id: %u\n", plot_.max_x, plot_.id);
+	ii("total data points: %zu\n", plot_.data_count);
+
+	if (!page_points())
+		return false;
+
+	/* passes read paged out points in place, what they read is dropped
+	 * after every pass, so loading doesn't pull in the whole file
+	 */
+	void (*passes[])(void) = { init_frames, init_flows, init_wakeups,
+	 init_irqs, init_residency, init_power, init_run_index, init_spans,
+	 init_m4 };
+
+	for (auto pass : passes) {
+		pass();
+		drop_pages();
+	}
+
+	if (pages_.failed) {
+		ee("failed to page out lanes\n");
+		return false;
+	}
+
+	return true;
+}
+
+template <typename T>
+static inline size_t get_vec_bytes(const std::vector<T> &v)
+{
+	return v.capacity() * sizeof(T);
+}
+
+/* what stays in memory once points and run index are paged out, it is
+ * taken off the budget
+ */
+static size_t get_pinned_size(void)
+{
+	size_t size = plot_.names.size;
+
+	for (auto &axis : plot_.y_axes) {
+		size += get_vec_bytes(axis.markers);
+		size += get_vec_bytes(axis.marker_labels);
+		size += get_vec_bytes(axis.migrations);
+		for (auto &depth : axis.spans)
+			size += get_vec_bytes(depth);
+		for (auto &level : axis.m4_samples)
+			size += get_vec_bytes(level);
+	}
+
+	for (auto &it : plot_.wakeups)
+		size += get_vec_bytes(it.second);
+	for (auto &irqs : plot_.irqs)
+		size += get_vec_bytes(irqs.hard) + get_vec_bytes(irqs.soft);
+	for (auto &steps : plot_.freqs)
+		size += get_vec_bytes(steps);
+
+	return size + get_vec_bytes(plot_.flows) +
+	 get_vec_bytes(plot_.span_stats) + get_vec_bytes(plot_.y_axes);
+}
+
+/* MEM_BUDGET_MB caps memory of resident points and run index, mb is the
+ * variable or nullptr
+ */
+static bool init_budget(const char *mb)
+{
+	char *end;
+	long budget;
+
+	if (!mb)
+		return true;
+
+	budget = strtol(mb, &end, 10);
+	if (end == mb || *end || budget <= 0) {
+		ee("memory budget must be a positive number of MB, got '%s'\n",
+		 mb);
+		return false;
+	}
+
+	if (!open_pages((size_t) budget << 20))
+		ww("failed to create temporary file, points stay in memory\n");
+
+	return true;
+}
+
+/* pages read while loading are dropped, drawing brings back what it needs */
+static void drop_loaded_pages(void)
+{
+	if (!pages_.base)
+		return;
+
+	drop_pages();
+	pages_.pinned = get_pinned_size();
+
+	ii("paged out %zu MB, %zu MB pinned, budget %zu MB\n",
+	 (pages_.size - pages_.freed) >> 20, pages_.pinned >> 20,
+	 pages_.budget >> 20);
+
+	if (pages_.pinned >= pages_.budget)
+		ww("pinned data exceeds budget, only drawn points stay\n");
+}
+
+static bool init_plot(const char *path)
+{
+	if (!init_budget(getenv("MEM_BUDGET_MB")))
+		return false;
+	else if (!open_data(path))
+		return false;
+	else if (!init_data())
+		return false;
 
-	plot_.max_x = plot_.plot_data.back().ts - plot_.plot_data.front().ts;
-	printf("max seconds: %f max id: %u\n", plot_.max_x, plot_.id);
-	ii("total data points: %zu\n", plot_.plot_data.size());
 	sort_y_axes();
+	plot_.filename = path;
+	drop_loaded_pages();
 	return true;
 }
 
-static bool init_plot(const char *path)
+static struct y_axis *get_task_axis(uint32_t pid)
+{
+	for (auto &axis : plot_.y_axes) {
+		if (axis.pid == pid && !axis.gpu && !axis.monitor && !axis.frame)
+			return &axis;
+	}
+
+	return nullptr;
+}
+
+/* last point of task strictly before ts */
+static struct point *get_prev_point(struct y_axis *axis, double ts)
+{
+	auto it = std::lower_bound(axis->points.begin(), axis->points.end(),
+	 ts, [](const struct point &p, double x) { return p.x < x; });
+
+	if (it == axis->points.begin())
+		return nullptr;
+
+	return &*(it - 1);
+}
+
+/* latest wakeup of task within [from, to] */
+static struct wakeup *get_wakeup(uint32_t pid, double from, double to)
+{
+	auto it = plot_.wakeups.find(pid);
+	if (it == plot_.wakeups.end())
+		return nullptr;
+
+	std::vector<struct wakeup> *v = &it->second;
+	auto w = std::upper_bound(v->begin(), v->end(), to,
+	 [](double x, const struct wakeup &w) { return x < w.ts; });
+
+	if (w == v->begin() || (w - 1)->ts < from)
+		return nullptr;
+
+	return &*(w - 1);
+}
+
+/* path is built backwards, so merge with piece on the right */
+static void add_path_segment(uint32_t pid, double start, double stop,
+ char state)
+{
+	if (stop <= start)
+		return;
+
+	if (plot_.path.size()) {
+		struct path_segment *s = &plot_.path.back();
+		if (s->pid == pid && s->state == state && s->start == stop) {
+			s->start = start;
+			return;
+		}
+	}
+
+	plot_.path.push_back({ pid, start, stop, state });
+}
+
+/* walk back from the end of interval: while task runs or waits for cpu the
+ * path stays on it; when it sleeps the path continues on the task which
+ * woke it up, from the wakeup time on; sleeps without known waker (e.g.
+ * interrupts) stay on the task as blocked
+ */
+static void find_critical_path(uint32_t pid, double start, double stop)
+{
+	struct y_axis *axis = get_task_axis(pid);
+	double ts = stop;
+	double jump_ts = -1;
+
+	plot_.path.clear();
+	plot_.path_start = start;
+	plot_.path_stop = stop;
+
+	for (uint32_t n = 0; axis && ts > start && n < max_path_steps_; ++n) {
+		struct point *point = get_prev_point(axis, ts);
+		if (!point)
+			break;
+
+		double x = point->x < start ? start : point->x;
+
+		if (point->arrived) {
+			add_path_segment(axis->pid, x, ts, 'R');
+			ts = x;
+			continue;
+		} else if (point->state == 'R') { /* preempted */
+			add_path_segment(axis->pid, x, ts, 'W');
+			ts = x;
+			continue;
+		}
+
+		struct wakeup *w = get_wakeup(axis->pid, point->x, ts);
+		struct y_axis *waker = nullptr;
+
+		/* same time jump back means wakers ping-pong, stop there */
+		if (w && w->waker && w->waker != axis->pid && w->ts != jump_ts)
+			waker = get_task_axis(w->waker);
+
+		if (!waker) {
+			add_path_segment(axis->pid, x, ts, 'S');
+			ts = x;
+			continue;
+		}
+
+		add_path_segment(axis->pid, w->ts < start ? start : w->ts, ts,
+		 'W');
+		ts = jump_ts = w->ts;
+		axis = waker;
+	}
+
+	std::reverse(plot_.path.begin(), plot_.path.end());
+
+	std::vector<uint32_t> tasks;
+	plot_.path_run = 0;
+	plot_.path_wait = 0;
+	plot_.path_blocked = 0;
+
+	for (auto &s : plot_.path) {
+		double d = s.stop - s.start;
+
+		if (s.state == 'R')
+			plot_.path_run += d;
+		else if (s.state == 'W')
+			plot_.path_wait += d;
+		else
+			plot_.path_blocked += d;
+
+		tasks.push_back(s.pid);
+	}
+
+	std::sort(tasks.begin(), tasks.end());
+	plot_.path_tasks =
+	 std::unique(tasks.begin(), tasks.end()) - tasks.begin();
+
+	ii("critical path %f..%f: %zu segments, %u tasks\n", start, stop,
+	 plot_.path.size(), plot_.path_tasks);
+}
+
+/* shift-click on task lane selects interval ending at the click and
+ * starting at locked measure cursor or else at previous marker; on frames
+ * lane the frame under cursor is the interval
+ */
+static void select_path(struct y_axis *axis)
+{
+	ImPlotPoint pt = ImPlot::GetPlotMousePos();
+	double start = ImPlot::GetPlotLimits().X.Min;
+
+	if (axis->gpu || axis->monitor) {
+		return;
+	} else if (axis->frame) {
+		auto it = std::upper_bound(axis->points.begin(),
+		 axis->points.end(), pt.x,
+		 [](double x, const struct point &p) { return x < p.x; });
+
+		if (it != axis->points.begin() && (--it)->xx >= pt.x)
+			find_critical_path(axis->pid, it->x, it->xx);
+		return;
+	}
+
+	if (axis->measure) {
+		start = ImPlot::PixelsToPlot(axis->prev_ex, 0).x;
+	} else {
+		auto it = std::lower_bound(axis->markers.begin(),
+		 axis->markers.end(), pt.x);
+		if (it != axis->markers.begin())
+			start = *(it - 1);
+	}
+
+	if (start < pt.x)
+		find_critical_path(axis->pid, start, pt.x);
+}
+
+static ImVec2 get_marker_offset(struct y_axis *axis, size_t i)
+{
+	uint8_t idx = i % 4;
+	if (idx == 0) {
+		axis->x_offset = -10;
+		axis->y_offset = -20;
+	} else if (idx == 1) {
+		axis->x_offset = -10;
+		axis->y_offset = 20;
+	} else if (idx == 2) {
+		axis->x_offset = 10;
+		axis->y_offset = -20;
+	} else { // idx == 3
+		axis->x_offset = 10;
+		axis->y_offset = 20;
+	}
+
+	return ImVec2(axis->x_offset, axis->y_offset);
+}
+
+static void show_marker_label(struct y_axis *axis, double y, size_t i)
+{
+	struct marker_label *l = &axis->marker_labels[i];
+	ImVec2 offset = get_marker_offset(axis, i);
+
+	double ts_diff;
+	if (i == 0)
+		ts_diff = 0;
+	else
+		ts_diff = l->ts - axis->marker_labels[i - 1].ts;
+
+	ImVec4 bg = ImVec4(axis->color.x * .4, axis->color.y * .4,
+	 axis->color.z * .4, 0);
+	ImPlot::Annotation(l->ts, y , bg, offset, false,
+	 " %s \n time %f \n diff %f\n", l->name, l->ts, ts_diff);
+}
+
+static inline bool is_clicked(double x, double y)
+{
+	ImVec2 pt = ImPlot::PlotToPixels(ImPlotPoint(x, y));
+
+	return (plot_.event &&
+	 abs(plot_.ex - pt.x) <= 4 && abs(plot_.ey - pt.y) <= 4);
+}
+
+static void handle_events(void)
+{
+	ImVec2 pt = ImGui::GetMousePos();
+	plot_.ex = pt.x;
+	plot_.ey = pt.y;
+
+	if (ImPlot::IsPlotHovered()) {
+		ImGui::SetMouseCursor(7);
+		if (ImGui::IsMouseClicked(0) && ImGui::GetIO().KeyShift) {
+			plot_.path_event = true;
+		} else if (ImGui::IsMouseClicked(0)) {
+			plot_.event = true;
+			plot_.reset_measure = false;
+		} else if (ImGui::IsMouseClicked(1)) {
+			plot_.reset_measure = true;
+		} else if (ImGui::IsMouseDown(0)) {
+			plot_.reset_measure = true;
+		}
+
+		ImGuiIO &io = ImGui::GetIO();
+		if (io.MouseWheel != 0 || io.MouseWheelH != 0)
+			plot_.reset_measure = true;
+	}
+}
+
+static inline void plot_dot(double x, double y)
+{
+	ImVec2 c = ImPlot::PlotToPixels(ImPlotPoint(x, y));
+	ImPlot::GetPlotDrawList()->AddCircleFilled(c, 5, dot_color_, 8);
+}
+
+static inline void show_markers(struct y_axis *axis)
+{
+        ImPlot::PushPlotClipRect();
+	for (size_t i = 0; i < axis->markers.size(); ++i) {
+		double x = axis->markers[i];
+		double y = y_high_;
+
+		plot_dot(x, y);
+
+		if (plot_.show_all_labels && plot_.enable_marker_info) {
+			show_marker_label(axis, y, i);
+		} else if (plot_.enable_marker_info) {
+			if (is_clicked(x, y)) {
+				if (axis->marker_labels[i].visible)
+					axis->marker_labels[i].visible = false;
+				else
+					axis->marker_labels[i].visible = true;
+			}
+
+			if (plot_.reset_labels)
+				axis->marker_labels[i].visible = false;
+			else if (axis->marker_labels[i].visible)
+				show_marker_label(axis, y, i);
+		}
+	}
+        ImPlot::PopPlotClipRect();
+}
+
+static inline void show_process_label(struct y_axis *axis, size_t i)
 {
-	if (!open_data(path))
-		return false;
-	else if (!init_data())
-		return false;
+	ImVec4 col = ImPlot::GetLastItemColor();
+	ImVec2 offset = ImVec2(15, -15);
+	double diff;
+	double x = -1;
 
-	plot_.filename = path;
-	return true;
+	/* find previous rise */
+	diff = -1;
+	for (ssize_t n = i - 1; n > 0; --n) {
+		if (axis->points[n].x >= 0) {
+			diff = axis->points[i].x - axis->points[n].x;
+			x = axis->points[n].x;
+			break;
+		}
+	}
+
+	ImVec4 bg = ImVec4(0, 0, 0, 0);
+
+	if (diff > 0 && plot_.max_khz) {
+		double mhz = get_freq_time(axis->points[i].cpu, x,
+		 axis->points[i].x) / diff / 1e3;
+		ImPlot::Annotation(axis->points[i].x, y_low_, bg, offset, false,
+		 " ts %f \n rt %f \n cpu %u state '%c' \n %.0f MHz ",
+		 axis->points[i].x, diff, axis->points[i].cpu,
+		 axis->points[i].state, mhz);
+		return;
+	}
+
+	ImPlot::Annotation(axis->points[i].x, y_low_, bg, offset,
+	 false, " ts %f \n rt %f \n cpu %u state '%c' ", axis->points[i].x,
+	 diff, axis->points[i].cpu, axis->points[i].state);
 }
 
-static ImVec2 get_marker_offset(struct y_axis *axis, size_t i)
+static void plot_cursor(struct y_axis *axis, double x, bool locked)
 {
-	uint8_t idx = i % 4;
-	if (idx == 0) {
-		axis->x_offset = -10;
-		axis->y_offset = -20;
-	} else if (idx == 1) {
-		axis->x_offset = -10;
-		axis->y_offset = 20;
-	} else if (idx == 2) {
-		axis->x_offset = 10;
-		axis->y_offset = -20;
-	} else { // idx == 3
-		axis->x_offset = 10;
-		axis->y_offset = 20;
+	double y;
+
+	(axis->gpu) ? (y = 0) : (y = y_low_);
+
+	ImPlotPoint pt = ImPlot::PixelsToPlot(x, 0);
+	double vx[] = { pt.x, pt.x };
+	double vy[] = { y, 1 };
+	const char *name = axis->name.c_str();
+
+	ImPlot::PushStyleColor(ImPlotCol_Line, cursor_color_);
+	ImPlot::PlotLine(name, vx, vy, ARRAY_SIZE(vx));
+	ImPlot::PopStyleColor(ImPlotCol_Line);
+
+	ImVec2 offset = ImVec2(-15, -15);
+	ImVec4 bg = ImVec4(axis->color.x * .4, axis->color.y * .4,
+	 axis->color.z * .4, 1);
+
+	if (plot_.event && !axis->measure) {
+		axis->measure = true;
+		axis->prev_ex = x;
+	} else if (plot_.event && axis->measure) {
+		axis->prev_ex = plot_.ex;
+	} else if (plot_.reset_measure) {
+		axis->measure = false;
 	}
 
-	return ImVec2(axis->x_offset, axis->y_offset);
+	double x_val;
+	if (axis->measure && !locked) {
+		ImPlotPoint prev = ImPlot::PixelsToPlot(axis->prev_ex, 0);
+		ImPlot::Annotation(pt.x, y, bg, offset, false,
+		 " %f \n %f ", pt.x, pt.x - prev.x);
+		return;
+	} else if (locked) {
+		ImPlotPoint prev = ImPlot::PixelsToPlot(axis->prev_ex, 0);
+		x_val = prev.x;
+	} else {
+		x_val = pt.x;
+	}
+
+	ImPlot::Annotation(pt.x, y_low_, bg, offset, false, " %f ", x_val);
 }
 
-static void show_marker_label(struct y_axis *axis, double y, size_t i)
+static inline bool is_job_clicked(struct point *point)
 {
-	struct marker_label *l = &axis->marker_labels[i];
-	ImVec2 offset = get_marker_offset(axis, i);
+	if (!plot_.event || is_clicked(point->xx, y_high_))
+		return false; /* process info marker */
 
-	double ts_diff;
-	if (i == 0)
-		ts_diff = 0;
+	ImPlotPoint pt = ImPlot::PixelsToPlot(plot_.ex, plot_.ey);
+	return (pt.x >= point->x && pt.x <= point->xx &&
+	 pt.y >= 0 && pt.y <= y_high_);
+}
+
+/* center view on submit marker of the job and select submitting thread */
+static void jump_to_submit(struct point *point)
+{
+	if (point->flow == UINT32_MAX)
+		return;
+
+	struct flow *flow = &plot_.flows[point->flow];
+
+	/* job id reused by a later job */
+	if (flow->start_ts != point->x)
+		return;
+
+	double half = ImPlot::GetPlotLimits().X.Size() / 2;
+	plot_.view_min = flow->submit_ts - half;
+	plot_.view_max = flow->submit_ts + half;
+	plot_.jump_view = true;
+
+	for (auto &axis : plot_.y_axes) {
+		if (axis.pid != flow->pid || axis.gpu || axis.monitor ||
+		 axis.frame)
+			continue;
+
+		axis.selected = true;
+		for (auto &l : axis.marker_labels) {
+			if (l.ts == flow->submit_ts)
+				l.visible = true;
+		}
+	}
+}
+
+static void plot_gpu(struct y_axis *axis, size_t i)
+{
+	double x[] = {
+		axis->points[i].x,
+		axis->points[i].x,
+		axis->points[i].xx,
+		axis->points[i].xx,
+	};
+
+	double y[] = {
+		0,
+		y_high_,
+		y_high_,
+		0,
+	};
+
+	ImPlotPoint pt = ImPlot::PixelsToPlot(plot_.ex, 0);
+	double vx[] = { pt.x, pt.x };
+	double vy[] = { 0, 1 };
+	const char *name = axis->name.c_str();
+	ImPlot::PushStyleColor(ImPlotCol_Line, cursor_color_);
+	ImPlot::PlotLine(name, vx, vy, ARRAY_SIZE(vx));
+	ImPlot::PopStyleColor(ImPlotCol_Line);
+
+	ImPlot::PushStyleColor(ImPlotCol_Line, axis->points[i].color);
+	ImPlot::PlotLine(name, x, y, ARRAY_SIZE(x));
+	ImPlot::PopStyleColor(ImPlotCol_Line);
+	ImPlot::PushStyleVar(ImPlotStyleVar_FillAlpha, fill_alpha_);
+	ImPlot::PlotShaded(name, x, y, ARRAY_SIZE(x), 0, 0);
+	ImPlot::PopStyleVar();
+
+	plot_cursor(axis, plot_.ex, false);
+
+	if (axis->measure)
+		plot_cursor(axis, axis->prev_ex, true);
+
+	/* process info marker */
+	ImPlot::PushPlotClipRect();
+	plot_dot(axis->points[i].xx, y_high_);
+	ImPlot::PopPlotClipRect();
+
+	if (is_job_clicked(&axis->points[i]))
+		jump_to_submit(&axis->points[i]);
+
+	if (plot_.enable_procinfo) {
+		if (is_clicked(axis->points[i].xx, y_high_)) {
+			if (axis->points[i].visible)
+				axis->points[i].visible = false;
+			else
+				axis->points[i].visible = true;
+		}
+
+		if (plot_.reset_labels) {
+			axis->points[i].visible = false;
+		} else if (axis->points[i].visible) {
+			ImVec2 offset = get_marker_offset(axis, i);
+			ImVec4 bg =
+			 ImGui::ColorConvertU32ToFloat4(axis->points[i].color);
+			bg.x *= .4;
+			bg.y *= .4;
+			bg.z *= .4;
+			bg.w = 0;
+			ImPlot::Annotation(axis->points[i].xx, y_high_, bg,
+			 offset, false, " job %u pid %u \n ts %f \n rt %f ",
+			 axis->points[i].cpu,
+			 axis->points[i].pid,
+			 axis->points[i].xx,
+			 axis->points[i].xx - axis->points[i].x);
+		}
+	}
+}
+
+/* points about to be drawn are kept resident over other paged out ones */
+static inline void touch_points(struct y_axis *axis, struct point *begin,
+ struct point *end)
+{
+	if (axis->points.map)
+		touch_pages(begin, (end - begin) * sizeof(*begin), plot_.frame);
+}
+
+/* min and max of pixel column in time order */
+static inline void add_monitor_column(std::vector<double> *x,
+ std::vector<double> *y, struct point *min, struct point *max)
+{
+	if (max < min)
+		std::swap(min, max);
+
+	x->push_back(min->x);
+	y->push_back(min->y);
+
+	if (min != max) {
+		x->push_back(max->x);
+		y->push_back(max->y);
+	}
+}
+
+/* visible samples reduced to min and max per pixel column; once samples are
+ * far enough apart they get dots and can be clicked for their values
+ */
+static void add_monitor_samples(struct y_axis *axis, double px,
+ std::vector<double> *x, std::vector<double> *y)
+{
+	ImPlotRect lim = ImPlot::GetPlotLimits();
+	struct point *min = nullptr;
+	struct point *max = nullptr;
+	double col = -1;
+
+	auto begin = std::upper_bound(axis->points.begin(), axis->points.end(),
+	 lim.X.Min, [](double x, const struct point &p) { return x < p.x; });
+	if (begin != axis->points.begin())
+		begin--;
+
+	auto end = std::upper_bound(begin, axis->points.end(), lim.X.Max,
+	 [](double x, const struct point &p) { return x < p.x; });
+	if (end != axis->points.end())
+		end++;
+
+	bool dots = (end - begin) * dot_spacing_ <= ImPlot::GetPlotSize().x;
+
+	touch_points(axis, begin, end);
+
+	for (auto it = begin; it != end; ++it) {
+		struct point *point = &*it;
+		double c = floor((point->x - lim.X.Min) / px);
+
+		if (dots) {
+			plot_dot(point->x, point->y);
+
+			if (is_clicked(point->x, point->y)) {
+				uint32_t i = it - axis->points.begin();
+				auto l = std::find(axis->labels.begin(),
+				 axis->labels.end(), i);
+				if (l == axis->labels.end())
+					axis->labels.push_back(i);
+				else
+					axis->labels.erase(l);
+			}
+		}
+
+		if (min && c == col) {
+			if (point->y < min->y)
+				min = point;
+			else if (point->y > max->y)
+				max = point;
+			continue;
+		}
+
+		if (min)
+			add_monitor_column(x, y, min, max);
+
+		col = c;
+		min = max = point;
+	}
+
+	if (min)
+		add_monitor_column(x, y, min, max);
+}
+
+/* buckets of the coarsest level still no wider than a pixel */
+static void add_m4_vertices(struct y_axis *axis, double px,
+ std::vector<double> *x, std::vector<double> *y)
+{
+	ImPlotRect lim = ImPlot::GetPlotLimits();
+	size_t k = std::min((size_t) log2(px / axis->m4_width),
+	 axis->m4.size() - 1);
+	std::vector<struct m4_bucket> *level = &axis->m4[k];
+	double w = axis->m4_width * (1 << k);
+	double min = lim.X.Min - axis->m4_origin;
+	double max = lim.X.Max - axis->m4_origin;
+	double from = std::max(floor(min / w) - 1, 0.);
+	double to = std::min(max / w + 1, level->size() - 1.);
+
+	for (size_t j = from; j <= to; ++j) {
+		uint32_t v[4];
+		uint8_t count = get_m4_samples(&(*level)[j], v);
+
+		for (uint8_t n = 0; n < count; ++n) {
+			x->push_back(axis->points[v[n]].x);
+			y->push_back(axis->points[v[n]].y);
+		}
+	}
+}
+
+/* same buckets taken from pinned samples, which are sorted by time */
+static void add_m4_pinned(struct y_axis *axis, double px,
+ std::vector<double> *x, std::vector<double> *y)
+{
+	ImPlotRect lim = ImPlot::GetPlotLimits();
+	size_t k = std::min((size_t) log2(px / axis->m4_width),
+	 axis->m4_base + axis->m4_samples.size() - 1);
+	std::vector<ImPlotPoint> *level = &axis->m4_samples[k - axis->m4_base];
+	double w = axis->m4_width * (1 << k);
+	double origin = axis->m4_origin;
+	double from = origin + (floor((lim.X.Min - origin) / w) - 1) * w;
+	double to = origin + (floor((lim.X.Max - origin) / w) + 2) * w;
+
+	auto it = std::lower_bound(level->begin(), level->end(), from,
+	 [](const ImPlotPoint &p, double x) { return p.x < x; });
+
+	for (; it != level->end() && it->x < to; ++it) {
+		x->push_back(it->x);
+		y->push_back(it->y);
+	}
+}
+
+/* whole lane is one line and one fill */
+static void plot_monitor(struct y_axis *axis)
+{
+	static std::vector<double> x;
+	static std::vector<double> y;
+	ImPlotRect lim = ImPlot::GetPlotLimits();
+	double px = lim.X.Size() / ImPlot::GetPlotSize().x;
+
+	x.clear();
+	y.clear();
+
+	if (axis->m4_samples.size() &&
+	 px >= axis->m4_width * (1 << axis->m4_base))
+		add_m4_pinned(axis, px, &x, &y);
+	else if (axis->m4.empty() || px < axis->m4_width)
+		add_monitor_samples(axis, px, &x, &y);
 	else
-		ts_diff = l->ts - axis->marker_labels[i - 1].ts;
+		add_m4_vertices(axis, px, &x, &y);
+
+	const char *name = axis->name.c_str();
+	ImPlot::PushStyleColor(ImPlotCol_Line, axis->color);
+	ImPlot::PlotLine(name, x.data(), y.data(), x.size());
+	ImPlot::PushStyleVar(ImPlotStyleVar_FillAlpha, fill_alpha_);
+	ImPlot::PlotShaded(name, x.data(), y.data(), x.size(), -INFINITY, 0);
+	ImPlot::PopStyleVar();
+	ImPlot::PopStyleColor(ImPlotCol_Line);
+
+	if (plot_.reset_labels)
+		axis->labels.clear();
+
+	for (uint32_t i : axis->labels) {
+		struct point *point = &axis->points[i];
+		ImPlot::Annotation(point->x, point->y, axis->color,
+		 ImVec2(15, -15), false, " %.f ", point->y);
+	}
+}
+
+/* step function of visible samples in one batch, value under cursor is
+ * shown as y tag
+ */
+static void plot_steps(struct y_axis *axis)
+{
+	static std::vector<double> x;
+	static std::vector<double> y;
+	ImPlotRect lim = ImPlot::GetPlotLimits();
+	ImPlotPoint mouse = ImPlot::GetPlotMousePos();
+	double value = -1;
+
+	auto it = std::upper_bound(axis->points.begin(), axis->points.end(),
+	 lim.X.Min, [](double x, const struct point &p) { return x < p.x; });
+	if (it != axis->points.begin())
+		it--;
+
+	struct point *begin = it;
+
+	x.clear();
+	y.clear();
+
+	for (; it != axis->points.end() && it->x <= lim.X.Max; ++it) {
+		if (x.size()) {
+			x.push_back(it->x);
+			y.push_back(y.back());
+		}
+
+		x.push_back(it->x);
+		y.push_back(it->y);
+
+		if (it->x <= mouse.x)
+			value = it->y;
+	}
+
+	touch_points(axis, begin, it);
+
+	if (x.empty())
+		return;
+
+	x.push_back(std::min(lim.X.Max, plot_.max_x));
+	y.push_back(y.back());
+
+	const char *name = axis->name.c_str();
+	ImPlot::PushStyleColor(ImPlotCol_Line, axis->color);
+	ImPlot::PlotLine(name, x.data(), y.data(), x.size());
+	ImPlot::PushStyleVar(ImPlotStyleVar_FillAlpha, fill_alpha_);
+	ImPlot::PlotShaded(name, x.data(), y.data(), x.size(), 0);
+	ImPlot::PopStyleVar();
+	ImPlot::PopStyleColor(ImPlotCol_Line);
+
+	if (value >= 0 && ImPlot::IsPlotHovered())
+		ImPlot::TagY(value, axis->color, " %.0f ", value);
+}
+
+/* one bar per frame from its present to the next one, bar height is frame
+ * time; frames longer than jank threshold are highlighted over whole lane
+ */
+static void plot_frames(struct y_axis *axis)
+{
+	struct frame_stats *stats = &axis->frame_stats;
+	double target = plot_.target_ms > 0 ? plot_.target_ms : stats->p50;
+	double jank = target * plot_.jank_factor;
+	ImPlotRect lim = ImPlot::GetPlotLimits();
+	ImDrawList *draw_list = ImPlot::GetPlotDrawList();
+	ImU32 color = ImGui::ColorConvertFloat4ToU32(axis->color);
+	ImVec4 jank_color = ImGui::ColorConvertU32ToFloat4(jank_color_);
+
+	/* points are sorted by time, start at frame covering left edge */
+	auto it = std::upper_bound(axis->points.begin(), axis->points.end(),
+	 lim.X.Min, [](double x, const struct point &p) { return x < p.x; });
+	if (it != axis->points.begin())
+		it--;
+
+	size_t i = it - axis->points.begin();
+
+	ImPlot::PushPlotClipRect();
+	for (; i < axis->points.size(); ++i) {
+		struct point *point = &axis->points[i];
+
+		if (point->x > lim.X.Max)
+			break;
+		else if (point->xx < 0)
+			continue;
+
+		ImVec2 top = ImPlot::PlotToPixels(point->x, point->y);
+		ImVec2 bottom = ImPlot::PlotToPixels(point->xx, 0);
+
+		if (point->y > jank) {
+			ImVec2 span = ImPlot::PlotToPixels(point->x, lim.Y.Max);
+			draw_list->AddRectFilled(span, bottom, jank_span_color_);
+			draw_list->AddRectFilled(top, bottom, jank_color_);
+		} else {
+			draw_list->AddRectFilled(top, bottom, color);
+		}
+
+		if (is_clicked(point->xx, point->y))
+			point->visible = !point->visible;
+
+		if (plot_.reset_labels) {
+			point->visible = false;
+		} else if (point->visible) {
+			ImVec2 offset = ImVec2(15, -15);
+			ImPlot::Annotation(point->xx, point->y, axis->color, offset,
+			 false, " frame %zu \n %.3f ms ", i, point->y);
+		}
+	}
+
+	touch_points(axis, it, axis->points.begin() + i);
+
+	ImVec2 left = ImPlot::PlotToPixels(lim.X.Min, jank);
+	ImVec2 right = ImPlot::PlotToPixels(lim.X.Max, jank);
+	draw_list->AddLine(left, right, jank_color_);
+	ImPlot::PopPlotClipRect();
+
+	ImPlot::TagY(jank, jank_color, " jank %u ", stats->jank);
+	ImPlot::TagY(stats->p50, axis->color, " p50 %.2f ", stats->p50);
+	ImPlot::TagY(stats->p90, axis->color, " p90 %.2f ", stats->p90);
+	ImPlot::TagY(stats->p99, axis->color, " p99 %.2f ", stats->p99);
 
-	ImVec4 bg = ImVec4(axis->color.x * .4, axis->color.y * .4,
-	 axis->color.z * .4, 0);
-	ImPlot::Annotation(l->ts, y , bg, offset, false,
-	 " %s \n time %f \n diff %f\n", l->name, l->ts, ts_diff);
+	plot_cursor(axis, plot_.ex, false);
+
+	if (axis->measure)
+		plot_cursor(axis, axis->prev_ex, true);
 }
 
-static inline bool is_clicked(double x, double y)
+/* critical path band just above run level */
+static void plot_path(struct y_axis *axis)
 {
-	ImVec2 pt = ImPlot::PlotToPixels(ImPlotPoint(x, y));
+	ImPlotRect lim = ImPlot::GetPlotLimits();
+	ImDrawList *draw_list = ImPlot::GetPlotDrawList();
 
-	return (plot_.event &&
-	 abs(plot_.ex - pt.x) <= 4 && abs(plot_.ey - pt.y) <= 4);
-}
+	/* segments don't overlap, so they are sorted by stop too */
+	auto it = std::lower_bound(plot_.path.begin(), plot_.path.end(),
+	 lim.X.Min, [](const struct path_segment &s, double x) {
+		return s.stop < x;
+	});
 
-static void handle_events(void)
-{
-	ImVec2 pt = ImGui::GetMousePos();
-	plot_.ex = pt.x;
-	plot_.ey = pt.y;
+	ImPlot::PushPlotClipRect();
+	for (; it != plot_.path.end() && it->start <= lim.X.Max; ++it) {
+		if (it->pid != axis->pid)
+			continue;
 
-	if (ImPlot::IsPlotHovered()) {
-		ImGui::SetMouseCursor(7);
-		if (ImGui::IsMouseClicked(0)) {
-			plot_.event = true;
-			plot_.reset_measure = false;
-		} else if (ImGui::IsMouseClicked(1)) {
-			plot_.reset_measure = true;
-		} else if (ImGui::IsMouseDown(0)) {
-			plot_.reset_measure = true;
-		}
+		ImVec2 min = ImPlot::PlotToPixels(it->start, y_high_ + path_band_);
+		ImVec2 max = ImPlot::PlotToPixels(it->stop, y_high_);
 
-		ImGuiIO &io = ImGui::GetIO();
-		if (io.MouseWheel != 0 || io.MouseWheelH != 0)
-			plot_.reset_measure = true;
+		if (it->state == 'R')
+			draw_list->AddRectFilled(min, max, path_color_);
+		else if (it->state == 'W')
+			draw_list->AddRectFilled(min, max, path_wait_color_);
+		else
+			draw_list->AddRect(min, max, path_color_);
 	}
+	ImPlot::PopPlotClipRect();
 }
 
-static inline void plot_dot(double x, double y)
+/* adjacent spans less than a pixel apart are merged into one band */
+struct irq_band {
+	float min = -1;
+	float max = -1;
+};
+
+static inline void flush_irq_band(ImDrawList *draw_list,
+ struct irq_band *band, float y0, float y1, ImU32 color)
 {
-	ImVec2 c = ImPlot::PlotToPixels(ImPlotPoint(x, y));
-	ImPlot::GetPlotDrawList()->AddCircleFilled(c, 5, dot_color_, 8);
+	if (band->max < 0)
+		return;
+
+	float max = band->max - band->min < 1 ? band->min + 1 : band->max;
+	draw_list->AddRectFilled(ImVec2(band->min, y0), ImVec2(max, y1), color);
+	band->min = -1;
+	band->max = -1;
 }
 
-static inline void show_markers(struct y_axis *axis)
+static void plot_irq_spans(ImDrawList *draw_list, struct irq_band *band,
+ std::vector<struct irq_span> *spans, double start, double stop,
+ float y0, float y1, ImU32 color)
 {
-        ImPlot::PushPlotClipRect();
-	for (size_t i = 0; i < axis->markers.size(); ++i) {
-		double x = axis->markers[i];
-		double y = y_high_;
+	/* no nesting within array, so spans are sorted by stop too */
+	auto it = std::lower_bound(spans->begin(), spans->end(), start,
+	 [](const struct irq_span &s, double x) { return s.stop < x; });
 
-		plot_dot(x, y);
+	while (it != spans->end() && it->start <= stop) {
+		float x0 = ImPlot::PlotToPixels(std::max(it->start, start), 0).x;
+		float x1 = ImPlot::PlotToPixels(std::min(it->stop, stop), 0).x;
 
-		if (plot_.show_all_labels && plot_.enable_marker_info) {
-			show_marker_label(axis, y, i);
-		} else if (plot_.enable_marker_info) {
-			if (is_clicked(x, y)) {
-				if (axis->marker_labels[i].visible)
-					axis->marker_labels[i].visible = false;
-				else
-					axis->marker_labels[i].visible = true;
-			}
+		if (band->max >= 0 && x0 - band->max < 1) {
+			band->max = std::max(band->max, x1);
+		} else {
+			flush_irq_band(draw_list, band, y0, y1, color);
+			band->min = x0;
+			band->max = x1;
+		}
 
-			if (plot_.reset_labels)
-				axis->marker_labels[i].visible = false;
-			else if (axis->marker_labels[i].visible)
-				show_marker_label(axis, y, i);
+		/* spans starting before the next pixel only widen the band and
+		 * the last of them does it most
+		 */
+		double next = ImPlot::PixelsToPlot(band->max + 1, 0).x;
+		auto skip = next > stop ?
+		 std::upper_bound(it + 1, spans->end(), stop,
+		 [](double x, const struct irq_span &s) { return x < s.start; }) :
+		 std::lower_bound(it + 1, spans->end(), next,
+		 [](const struct irq_span &s, double x) { return s.start < x; });
+
+		if (skip - it > 1) {
+			x1 = ImPlot::PlotToPixels(std::min((skip - 1)->stop, stop),
+			 0).x;
+			band->max = std::max(band->max, x1);
 		}
+
+		it = skip;
 	}
-        ImPlot::PopPlotClipRect();
 }
 
-static inline void show_process_label(struct y_axis *axis, size_t i)
+/* interrupts which hit the cpu while task was running on it */
+static void plot_irqs(struct y_axis *axis)
 {
-	ImVec4 col = ImPlot::GetLastItemColor();
-	ImVec2 offset = ImVec2(15, -15);
-	double diff;
-	double x = -1;
+	ImPlotRect lim = ImPlot::GetPlotLimits();
+	ImDrawList *draw_list = ImPlot::GetPlotDrawList();
+	struct irq_band hard;
+	struct irq_band soft;
+
+	float y0 = ImPlot::PlotToPixels(0, y_high_).y;
+	float y1 = ImPlot::PlotToPixels(0, y_high_ - irq_band_).y;
+	float y2 = ImPlot::PlotToPixels(0, y_high_ - irq_band_ * 2).y;
+
+	/* start from the slice which may begin left of the view */
+	auto it = std::lower_bound(axis->points.begin(), axis->points.end(),
+	 lim.X.Min, [](const struct point &p, double x) { return p.x < x; });
+	size_t i = it - axis->points.begin();
+	if (i)
+		i--;
 
-	/* find previous rise */
-	diff = -1;
-	for (ssize_t n = i - 1; n > 0; --n) {
-		if (axis->points[n].x >= 0) {
-			diff = axis->points[i].x - axis->points[n].x;
-			x = axis->points[n].x;
+	ImPlot::PushPlotClipRect();
+	for (; i + 1 < axis->points.size(); ++i) {
+		struct point *point = &axis->points[i];
+
+		if (point->x > lim.X.Max)
 			break;
-		}
+		else if (!point->arrived || point->cpu >= plot_.irqs.size())
+			continue;
+
+		struct cpu_irqs *irqs = &plot_.irqs[point->cpu];
+		double stop = axis->points[i + 1].x;
+
+		plot_irq_spans(draw_list, &hard, &irqs->hard, point->x, stop,
+		 y0, y1, irq_color_);
+		plot_irq_spans(draw_list, &soft, &irqs->soft, point->x, stop,
+		 y1, y2, softirq_color_);
 	}
 
-	ImVec4 bg = ImVec4(0, 0, 0, 0);
-	ImPlot::Annotation(axis->points[i].x, y_low_, bg, offset,
-	 false, " ts %f \n rt %f \n cpu %u state '%c' ", axis->points[i].x,
-	 diff, axis->points[i].cpu, axis->points[i].state);
+	flush_irq_band(draw_list, &hard, y0, y1, irq_color_);
+	flush_irq_band(draw_list, &soft, y1, y2, softirq_color_);
+	ImPlot::PopPlotClipRect();
 }
 
-static void plot_cursor(struct y_axis *axis, double x, bool locked)
+/* ticks at the bottom of lane, at most one per 2 pixels */
+static void plot_migrations(struct y_axis *axis)
 {
-	double y;
+	ImPlotRect lim = ImPlot::GetPlotLimits();
+	ImDrawList *draw_list = ImPlot::GetPlotDrawList();
+	float y0 = ImPlot::PlotToPixels(0, 0).y;
+	float y1 = ImPlot::PlotToPixels(0, y_low_).y - 3;
+	float prev_x = -2;
 
-	(axis->gpu) ? (y = 0) : (y = y_low_);
+	auto it = std::lower_bound(axis->migrations.begin(),
+	 axis->migrations.end(), lim.X.Min,
+	 [](const struct migration &m, double x) { return m.ts < x; });
 
-	ImPlotPoint pt = ImPlot::PixelsToPlot(x, 0);
-	double vx[] = { pt.x, pt.x };
-	double vy[] = { y, 1 };
-	const char *name = axis->name.c_str();
+	ImPlot::PushPlotClipRect();
+	for (; it != axis->migrations.end() && it->ts <= lim.X.Max; ++it) {
+		float x = ImPlot::PlotToPixels(it->ts, 0).x;
 
-	ImPlot::PushStyleColor(ImPlotCol_Line, cursor_color_);
-	ImPlot::PlotLine(name, vx, vy, ARRAY_SIZE(vx));
-	ImPlot::PopStyleColor(ImPlotCol_Line);
+		if (x - prev_x < 2)
+			continue;
 
-	ImVec2 offset = ImVec2(-15, -15);
-	ImVec4 bg = ImVec4(axis->color.x * .4, axis->color.y * .4,
-	 axis->color.z * .4, 1);
+		draw_list->AddLine(ImVec2(x, y0), ImVec2(x, y1), migrate_color_);
+		prev_x = x;
+	}
+	ImPlot::PopPlotClipRect();
+}
 
-	if (plot_.event && !axis->measure) {
-		axis->measure = true;
-		axis->prev_ex = x;
-	} else if (plot_.event && axis->measure) {
-		axis->prev_ex = plot_.ex;
-	} else if (plot_.reset_measure) {
-		axis->measure = false;
+/* flame chart, one row per depth; spans narrower than a pixel next to each
+ * other are merged, names are drawn into bars wide enough for them
+ */
+static void plot_spans(struct y_axis *axis)
+{
+	ImPlotRect lim = ImPlot::GetPlotLimits();
+	ImDrawList *draw_list = ImPlot::GetPlotDrawList();
+	ImPlotPoint mouse = ImPlot::GetPlotMousePos();
+	bool hovered = ImPlot::IsPlotHovered();
+	size_t depths = std::min(axis->spans.size(), (size_t) max_span_depth_);
+
+	ImPlot::PushPlotClipRect();
+	for (size_t d = 0; d < depths; ++d) {
+		std::vector<struct span> *spans = &axis->spans[d];
+		double y0 = span_base_ + d * span_height_;
+		double y1 = y0 + span_height_ * .9;
+		struct irq_band band;
+
+		auto it = std::lower_bound(spans->begin(), spans->end(),
+		 lim.X.Min, [](const struct span &s, double x) {
+			return s.stop < x;
+		});
+
+		for (; it != spans->end() && it->start <= lim.X.Max; ++it) {
+			ImVec2 min = ImPlot::PlotToPixels(it->start, y1);
+			ImVec2 max = ImPlot::PlotToPixels(it->stop, y0);
+
+			if (max.x - min.x < 1) {
+				if (band.max >= 0 && min.x - band.max < 1) {
+					band.max = std::max(band.max, max.x);
+					continue;
+				}
+
+				flush_irq_band(draw_list, &band, min.y, max.y,
+				 cursor_color_);
+				band.min = min.x;
+				band.max = max.x;
+				continue;
+			}
+
+			flush_irq_band(draw_list, &band, min.y, max.y,
+			 cursor_color_);
+
+			ImU32 color = std::hash<std::string_view>{}(it->name);
+			color |= IM_COL32_A_MASK;
+			draw_list->AddRectFilled(min, max, color);
+
+			ImVec2 size = ImGui::CalcTextSize(it->name);
+			if (size.x + 4 < max.x - min.x) {
+				draw_list->AddText(ImVec2(min.x + 2, min.y),
+				 text_color_, it->name);
+			}
+
+			if (hovered && mouse.x >= it->start &&
+			 mouse.x <= it->stop && mouse.y >= y0 &&
+			 mouse.y <= y1) {
+				ImGui::SetTooltip("%s\n%.3f ms", it->name,
+				 (it->stop - it->start) * 1e3);
+			}
+		}
+
+		flush_irq_band(draw_list, &band,
+		 ImPlot::PlotToPixels(0, y1).y, ImPlot::PlotToPixels(0, y0).y,
+		 cursor_color_);
 	}
+	ImPlot::PopPlotClipRect();
+}
 
-	double x_val;
-	if (axis->measure && !locked) {
-		ImPlotPoint prev = ImPlot::PixelsToPlot(axis->prev_ex, 0);
-		ImPlot::Annotation(pt.x, y, bg, offset, false,
-		 " %f \n %f ", pt.x, pt.x - prev.x);
-		return;
-	} else if (locked) {
-		ImPlotPoint prev = ImPlot::PixelsToPlot(axis->prev_ex, 0);
-		x_val = prev.x;
-	} else {
-		x_val = pt.x;
+/* utilization per bucket over the whole lane height, buckets are aligned
+ * to multiples of bucket width so the line doesn't shimmer while panning;
+ * never more than one bucket per pixel, so cost is O(pixels log n)
+ */
+static void plot_utilization(struct y_axis *axis)
+{
+	static std::vector<double> x;
+	static std::vector<double> y;
+	struct run_index *idx = &axis->run_index;
+	ImPlotRect lim = ImPlot::GetPlotLimits();
+	double pixel = lim.X.Size() / ImPlot::GetPlotSize().x;
+	double bucket = plot_.util_bucket_ms / 1e3;
+	double end = std::min(lim.X.Max, plot_.max_x);
+
+	if (bucket < pixel)
+		bucket = pixel;
+
+	x.clear();
+	y.clear();
+
+	for (double t = floor(std::max(lim.X.Min, 0.) / bucket) * bucket;
+	 t < end; t += bucket) {
+		double util = get_utilization(idx, t, t + bucket);
+		x.push_back(t);
+		y.push_back(util);
+		x.push_back(t + bucket);
+		y.push_back(util);
 	}
 
-	ImPlot::Annotation(pt.x, y_low_, bg, offset, false, " %f ", x_val);
+	if (x.empty())
+		return;
+
+	ImPlot::PushStyleColor(ImPlotCol_Line, util_color_);
+	ImPlot::PlotLine(axis->name.c_str(), x.data(), y.data(), x.size());
+	ImPlot::PopStyleColor(ImPlotCol_Line);
+
+	double util = get_utilization(idx, std::max(lim.X.Min, 0.), end);
+	ImPlot::TagY(util, ImGui::ColorConvertU32ToFloat4(util_color_),
+	 " %.0f%% ", util * 100);
 }
 
-static void plot_gpu(struct y_axis *axis, size_t i)
+static size_t plot_axis(struct y_axis *axis, size_t i, double *prev_x)
 {
+	size_t ii = i;
+	/* search for next departure point */
+	for (size_t n = i; n < axis->points.size(); ++n) {
+		if (axis->points[n].x > axis->points[i].x &&
+		 !axis->points[n].arrived) {
+			ii = n;
+			break;
+		}
+	}
+
+	if (i == ii)
+		return i;
+
 	double x[] = {
+		*prev_x,
 		axis->points[i].x,
 		axis->points[i].x,
-		axis->points[i].xx,
-		axis->points[i].xx,
+		axis->points[ii].x,
+		axis->points[ii].x,
 	};
 
 	double y[] = {
-		0,
+		y_low_,
+		y_low_,
 		y_high_,
 		y_high_,
-		0,
+		y_low_,
 	};
 
-	ImPlotPoint pt = ImPlot::PixelsToPlot(plot_.ex, 0);
-	double vx[] = { pt.x, pt.x };
-	double vy[] = { 0, 1 };
 	const char *name = axis->name.c_str();
-	ImPlot::PushStyleColor(ImPlotCol_Line, cursor_color_);
-	ImPlot::PlotLine(name, vx, vy, ARRAY_SIZE(vx));
-	ImPlot::PopStyleColor(ImPlotCol_Line);
-
-	ImPlot::PushStyleColor(ImPlotCol_Line, axis->points[i].color);
+	ImPlot::PushStyleColor(ImPlotCol_Line, axis->color);
 	ImPlot::PlotLine(name, x, y, ARRAY_SIZE(x));
 	ImPlot::PopStyleColor(ImPlotCol_Line);
 	ImPlot::PushStyleVar(ImPlotStyleVar_FillAlpha, fill_alpha_);
-	ImPlot::PlotShaded(name, x, y, ARRAY_SIZE(x), 0, 0);
+	ImPlot::PlotShaded(name, x, y, ARRAY_SIZE(x), y_low_, 0);
 	ImPlot::PopStyleVar();
 
 	plot_cursor(axis, plot_.ex, false);
@@ -1073,146 +3717,204 @@ static void plot_gpu(struct y_axis *axis, size_t i)
 
 	/* process info marker */
 	ImPlot::PushPlotClipRect();
-	plot_dot(axis->points[i].xx, y_high_);
+	plot_dot(*prev_x, y_low_);
 	ImPlot::PopPlotClipRect();
 
-	if (plot_.enable_procinfo) {
-		if (is_clicked(axis->points[i].xx, y_high_)) {
-			if (axis->points[i].visible)
-				axis->points[i].visible = false;
+	if (plot_.show_all_labels && plot_.enable_procinfo) {
+		show_process_label(axis, ii);
+	} else if (plot_.enable_procinfo) {
+		if (is_clicked(axis->points[ii].x, y_low_)) {
+			if (axis->points[ii].visible)
+				axis->points[ii].visible = false;
 			else
-				axis->points[i].visible = true;
+				axis->points[ii].visible = true;
 		}
 
-		if (plot_.reset_labels) {
-			axis->points[i].visible = false;
-		} else if (axis->points[i].visible) {
-			ImVec2 offset = get_marker_offset(axis, i);
-			ImVec4 bg =
-			 ImGui::ColorConvertU32ToFloat4(axis->points[i].color);
-			bg.x *= .4;
-			bg.y *= .4;
-			bg.z *= .4;
-			bg.w = 0;
-			ImPlot::Annotation(axis->points[i].xx, y_high_, bg,
-			 offset, false, " job %u pid %u \n ts %f \n rt %f ",
-			 axis->points[i].cpu,
-			 axis->points[i].pid,
-			 axis->points[i].xx,
-			 axis->points[i].xx - axis->points[i].x);
-		}
+		if (plot_.reset_labels)
+			axis->points[ii].visible = false;
+		else if (axis->points[ii].visible)
+			show_process_label(axis, ii);
 	}
+
+	*prev_x = axis->points[ii].x;
+	return ii;
 }
 
-static void plot_monitor(struct y_axis *axis, size_t i)
+/* slices from the last departure left of the view to the first one right of
+ * it; idle line of the first slice starts at that departure
+ */
+static void plot_slices(struct y_axis *axis)
 {
-	if (i == 0)
-		return; /* skip first point */
+	ImPlotRect lim = ImPlot::GetPlotLimits();
+	struct point *points = axis->points.begin();
+	size_t n = axis->points.size();
+	double prev_x = 0;
 
-	double x[] = {
-		axis->points[i - 1].x,
-		axis->points[i].x,
-	};
+	size_t i = std::lower_bound(points, points + n, lim.X.Min,
+	 [](const struct point &p, double x) { return p.x < x; }) - points;
 
-	double y[] = {
-		axis->points[i - 1].y,
-		axis->points[i].y,
-	};
+	/* departure at time of arrival before it doesn't end slice, see
+	 * plot_axis(), so keep looking before that arrival
+	 */
+	for (;;) {
+		while (i > 0 && (points[i - 1].arrived || points[i - 1].x < 0))
+			i--;
 
-	const char *name = axis->name.c_str();
-	ImPlot::PushStyleColor(ImPlotCol_Line, axis->color);
-	ImPlot::PlotLine(name, x, y, ARRAY_SIZE(x));
-	ImPlot::PushStyleVar(ImPlotStyleVar_FillAlpha, fill_alpha_);
-	ImPlot::PlotShaded(name, x, y, ARRAY_SIZE(x), -INFINITY, 0);
-	ImPlot::PopStyleVar();
+		if (i == 0)
+			break;
 
-	plot_dot(axis->points[i].x, axis->points[i].y);
+		size_t a = --i;
+		while (a > 0 && !points[a - 1].arrived)
+			a--;
 
-	if (is_clicked(axis->points[i].x, axis->points[i].y)) {
-		if (axis->points[i].visible)
-			axis->points[i].visible = false;
-		else
-			axis->points[i].visible = true;
+		if (a == 0 || points[a - 1].x < points[i].x) {
+			prev_x = points[i].x;
+			break;
+		}
+
+		i = a - 1;
+	}
+
+	size_t first = i;
+
+	for (; i + 1 < n; ++i) {
+		if (points[i].x < 0)
+			continue;
+		else if (!points[i].arrived)
+			continue;
+
+		i = plot_axis(axis, i, &prev_x);
+		if (points[i].x > lim.X.Max)
+			break;
+	}
+
+	touch_points(axis, points + first, points + std::min(i + 1, n));
+}
+
+/* jobs may overlap, so all are drawn unless points are paged out, then ones
+ * from the last job started left of the view
+ */
+static void plot_jobs(struct y_axis *axis)
+{
+	ImPlotRect lim = ImPlot::GetPlotLimits();
+	struct point *points = axis->points.begin();
+	size_t n = axis->points.size();
+	size_t i = 0;
+
+	if (axis->points.map) {
+		i = std::upper_bound(points, points + n, lim.X.Min,
+		 [](double x, const struct point &p) { return x < p.x; }) -
+		 points;
+		if (i)
+			i--;
 	}
 
-	if (plot_.reset_labels) {
-		axis->points[i].visible = false;
-	} else if (axis->points[i].visible) {
-		ImVec2 offset = ImVec2(15, -15);
-		ImPlot::Annotation(axis->points[i].x, axis->points[i].y,
-		 axis->color, offset, false, " %.f ", axis->points[i].y);
-	}
+	size_t first = i;
+
+	for (; i + 1 < n; ++i) {
+		if (points[i].x < 0)
+			continue;
+		else if (!points[i].arrived)
+			continue;
+		else if (axis->points.map && points[i].x > lim.X.Max)
+			break;
+
+		plot_gpu(axis, i);
+	}
+
+	touch_points(axis, points + first, points + std::min(i + 1, n));
+}
+
+/* more slices in view than pixels, tells from run index without touching
+ * points
+ */
+static bool is_dense(struct y_axis *axis)
+{
+	ImPlotRect lim = ImPlot::GetPlotLimits();
+	size_t i0;
+	size_t i1;
 
-	ImPlot::PopStyleColor(ImPlotCol_Line);
+	get_range_run(&axis->run_index, lim.X.Min, lim.X.Max, &i0, &i1);
+	return i1 + 1 > i0 + ImPlot::GetPlotSize().x;
 }
 
-static size_t plot_axis(struct y_axis *axis, size_t i, double *prev_x)
+/* zoomed out lane drawn from run index, every pixel column is as high as
+ * share of it task was running
+ */
+static void plot_run_share(struct y_axis *axis)
 {
-	size_t ii = i;
-	/* search for next departure point */
-	for (size_t n = i; n < axis->points.size(); ++n) {
-		if (axis->points[n].x > axis->points[i].x &&
-		 !axis->points[n].arrived) {
-			ii = n;
-			break;
-		}
+	static std::vector<double> x;
+	static std::vector<double> y;
+	ImPlotRect lim = ImPlot::GetPlotLimits();
+	double px = lim.X.Size() / ImPlot::GetPlotSize().x;
+	double end = std::min(lim.X.Max, plot_.max_x);
+
+	x.clear();
+	y.clear();
+
+	for (double t = floor(std::max(lim.X.Min, 0.) / px) * px; t < end;
+	 t += px) {
+		double util = get_utilization(&axis->run_index, t, t + px);
+		double level = y_low_ + util * (y_high_ - y_low_);
+
+		x.push_back(t);
+		y.push_back(level);
+		x.push_back(t + px);
+		y.push_back(level);
 	}
 
-	if (i == ii)
-		return i;
+	plot_cursor(axis, plot_.ex, false);
 
-	double x[] = {
-		*prev_x,
-		axis->points[i].x,
-		axis->points[i].x,
-		axis->points[ii].x,
-		axis->points[ii].x,
-	};
+	if (axis->measure)
+		plot_cursor(axis, axis->prev_ex, true);
 
-	double y[] = {
-		y_low_,
-		y_low_,
-		y_high_,
-		y_high_,
-		y_low_,
-	};
+	if (x.empty())
+		return;
 
 	const char *name = axis->name.c_str();
 	ImPlot::PushStyleColor(ImPlotCol_Line, axis->color);
-	ImPlot::PlotLine(name, x, y, ARRAY_SIZE(x));
+	ImPlot::PlotLine(name, x.data(), y.data(), x.size());
 	ImPlot::PopStyleColor(ImPlotCol_Line);
 	ImPlot::PushStyleVar(ImPlotStyleVar_FillAlpha, fill_alpha_);
-	ImPlot::PlotShaded(name, x, y, ARRAY_SIZE(x), y_low_, 0);
+	ImPlot::PlotShaded(name, x.data(), y.data(), x.size(), y_low_, 0);
 	ImPlot::PopStyleVar();
+}
 
-	plot_cursor(axis, plot_.ex, false);
+/* middle button drag selects range in any lane, x axes are linked */
+static void update_range(void)
+{
+	ImPlotPoint pt = ImPlot::GetPlotMousePos();
+
+	if (ImPlot::IsPlotHovered() && ImGui::IsMouseClicked(2)) {
+		plot_.range_drag = true;
+		plot_.range_valid = false;
+		plot_.range_min = pt.x;
+		plot_.range_max = pt.x;
+	} else if (plot_.range_drag && ImGui::IsMouseDown(2)) {
+		plot_.range_max = pt.x;
+	} else if (plot_.range_drag) {
+		plot_.range_drag = false;
+		if (plot_.range_min > plot_.range_max)
+			std::swap(plot_.range_min, plot_.range_max);
+
+		plot_.range_valid = plot_.range_min < plot_.range_max;
+		if (plot_.range_valid)
+			update_range_stats();
+	}
+}
 
-	if (axis->measure)
-		plot_cursor(axis, axis->prev_ex, true);
+static void plot_range(void)
+{
+	ImPlotRect lim = ImPlot::GetPlotLimits();
+	ImVec2 min = ImPlot::PlotToPixels(plot_.range_min, lim.Y.Max);
+	ImVec2 max = ImPlot::PlotToPixels(plot_.range_max, lim.Y.Min);
+
+	if (min.x > max.x)
+		std::swap(min.x, max.x);
 
-	/* process info marker */
 	ImPlot::PushPlotClipRect();
-	plot_dot(*prev_x, y_low_);
+	ImPlot::GetPlotDrawList()->AddRectFilled(min, max, range_color_);
 	ImPlot::PopPlotClipRect();
-
-	if (plot_.show_all_labels && plot_.enable_procinfo) {
-		show_process_label(axis, ii);
-	} else if (plot_.enable_procinfo) {
-		if (is_clicked(axis->points[ii].x, y_low_)) {
-			if (axis->points[ii].visible)
-				axis->points[ii].visible = false;
-			else
-				axis->points[ii].visible = true;
-		}
-
-		if (plot_.reset_labels)
-			axis->points[ii].visible = false;
-		else if (axis->points[ii].visible)
-			show_process_label(axis, ii);
-	}
-
-	*prev_x = axis->points[ii].x;
-	return ii;
 }
 
 static inline void show_plot(struct y_axis *axis)
@@ -1224,7 +3926,7 @@ static inline void show_plot(struct y_axis *axis)
 
 	ImPlot::SetupAxes("", nullptr, x_flags_, y_flags_);
 
-	if (axis->monitor) {
+	if (axis->monitor || axis->frame) {
 		ImPlot::SetupAxesLimits2(0, plot_.max_x, 0, axis->max_y * 1.5,
 		 ImPlotCond_Once, ImPlotCond_Always);
 	} else {
@@ -1233,22 +3935,64 @@ static inline void show_plot(struct y_axis *axis)
 		ImPlot::SetupAxisFormat(ImAxis_Y1, "");
 	}
 
+	if (plot_.set_view) {
+		ImPlot::SetupAxisLimits(ImAxis_X1, plot_.view_min,
+		 plot_.view_max, ImPlotCond_Always);
+	}
+
 	handle_events(); /* get event's xy */
 
-	double prev_x = 0;
-	for (size_t i = 0; i < axis->points.size() - 1; ++i) {
-		if (axis->points[i].x < 0)
-			continue;
-		else if (!axis->points[i].arrived)
-			continue;
+	axis->plot_frame = plot_.frame;
+	axis->plot_pos = ImPlot::GetPlotPos();
+	axis->plot_size = ImPlot::GetPlotSize();
+	axis->plot_rect = ImPlot::GetPlotLimits();
 
-		if (axis->gpu)
-			plot_gpu(axis, i);
-		else if (axis->monitor)
-			plot_monitor(axis, i);
-		else
-			i = plot_axis(axis, i, &prev_x);
+	if (plot_.path_event && ImPlot::IsPlotHovered())
+		select_path(axis);
+
+	update_range();
+	if (plot_.range_drag || plot_.range_valid)
+		plot_range();
+
+	if (axis->frame) {
+		plot_frames(axis);
+		ImPlot::EndPlot();
+		return;
+	} else if (axis->power) {
+		plot_steps(axis);
+		ImPlot::EndPlot();
+		return;
+	} else if (axis->monitor) {
+		plot_monitor(axis);
+		show_markers(axis);
+		ImPlot::EndPlot();
+		return;
 	}
+
+	if (axis->gpu)
+		plot_jobs(axis);
+	else if (axis->points.map && is_dense(axis))
+		plot_run_share(axis);
+	else
+		plot_slices(axis);
+
+	if (!axis->gpu && !axis->monitor && plot_.show_irqs &&
+	 plot_.irqs.size())
+		plot_irqs(axis);
+
+	if (!axis->gpu && !axis->monitor && axis->migrations.size())
+		plot_migrations(axis);
+
+	if (!axis->gpu && !axis->monitor && axis->spans.size())
+		plot_spans(axis);
+
+	if (!axis->gpu && !axis->monitor && plot_.show_util &&
+	 axis->run_index.start.size())
+		plot_utilization(axis);
+
+	if (!axis->gpu && !axis->monitor && plot_.path.size())
+		plot_path(axis);
+
 	show_markers(axis);
 
 	if (axis->gpu) {
@@ -1266,6 +4010,317 @@ static inline void show_plot(struct y_axis *axis)
 	ImPlot::EndPlot();
 }
 
+static inline ImVec2 get_lane_pos(struct y_axis *axis, double x, double y)
+{
+	ImPlotRect *r = &axis->plot_rect;
+
+	return ImVec2(axis->plot_pos.x +
+	 (x - r->X.Min) / r->X.Size() * axis->plot_size.x,
+	 axis->plot_pos.y +
+	 (r->Y.Max - y) / r->Y.Size() * axis->plot_size.y);
+}
+
+/* connect submit markers to GPU jobs across subplots; plots are laid out
+ * by now, so use their recorded pixel rects and draw on top of them
+ */
+static void show_flows(void)
+{
+	struct y_axis *gpu = &plot_.y_axes[plot_.gpu_plot_id];
+	std::unordered_map<uint32_t, struct y_axis *> lanes;
+
+	if (!plot_.show_flows || plot_.flows.empty())
+		return;
+	else if (!gpu->gpu || gpu->plot_frame != plot_.frame)
+		return;
+
+	ImVec2 clip_min = gpu->plot_pos;
+	ImVec2 clip_max = ImVec2(gpu->plot_pos.x + gpu->plot_size.x,
+	 gpu->plot_pos.y + gpu->plot_size.y);
+
+	for (auto &axis : plot_.y_axes) {
+		if (axis.plot_frame != plot_.frame || axis.gpu ||
+		 axis.monitor || axis.frame)
+			continue;
+
+		lanes[axis.pid] = &axis;
+		if (clip_min.y > axis.plot_pos.y)
+			clip_min.y = axis.plot_pos.y;
+		if (clip_max.y < axis.plot_pos.y + axis.plot_size.y)
+			clip_max.y = axis.plot_pos.y + axis.plot_size.y;
+	}
+
+	if (lanes.empty())
+		return;
+
+	double min = gpu->plot_rect.X.Min - plot_.max_flow_lag;
+	double max = gpu->plot_rect.X.Max + plot_.max_flow_lag;
+	auto it = std::lower_bound(plot_.flows.begin(), plot_.flows.end(), min,
+	 [](const struct flow &f, double x) { return f.submit_ts < x; });
+
+	ImDrawList *list = ImGui::GetWindowDrawList();
+	list->PushClipRect(clip_min, clip_max, true);
+
+	float prev_x = -1;
+	for (; it != plot_.flows.end() && it->submit_ts <= max; ++it) {
+		auto lane = lanes.find(it->pid);
+		if (lane == lanes.end())
+			continue;
+
+		ImVec2 p0 = get_lane_pos(lane->second, it->submit_ts, y_high_);
+		ImVec2 p1 = get_lane_pos(gpu, it->start_ts, y_high_);
+
+		if (p1.x < clip_min.x && p0.x < clip_min.x)
+			continue;
+		else if (p1.x > clip_max.x && p0.x > clip_max.x)
+			continue;
+		else if (fabs(p1.x - prev_x) < 2)
+			continue; /* too dense to tell apart */
+
+		prev_x = p1.x;
+
+		ImVec4 c = lane->second->color;
+		c.w = flow_alpha_;
+		ImU32 color = ImGui::ColorConvertFloat4ToU32(c);
+		float mid = (p0.y + p1.y) / 2;
+		float dir = p1.y > p0.y ? -6 : 6;
+
+		list->AddBezierCubic(p0, ImVec2(p0.x, mid), ImVec2(p1.x, mid),
+		 p1, color, 1.5);
+		list->AddTriangleFilled(p1, ImVec2(p1.x - 4, p1.y + dir),
+		 ImVec2(p1.x + 4, p1.y + dir), color);
+	}
+
+	list->PopClipRect();
+}
+
+/* vertical links where critical path hops from wakee to waker lane */
+static void show_path(void)
+{
+	std::unordered_map<uint32_t, struct y_axis *> lanes;
+	ImVec2 clip_min;
+	ImVec2 clip_max;
+	bool first = true;
+
+	if (plot_.path.size() < 2)
+		return;
+
+	for (auto &axis : plot_.y_axes) {
+		if (axis.plot_frame != plot_.frame)
+			continue;
+
+		if (first) {
+			clip_min = axis.plot_pos;
+			clip_max = axis.plot_pos;
+			first = false;
+		}
+
+		clip_min.y = std::min(clip_min.y, axis.plot_pos.y);
+		clip_max.x = std::max(clip_max.x,
+		 axis.plot_pos.x + axis.plot_size.x);
+		clip_max.y = std::max(clip_max.y,
+		 axis.plot_pos.y + axis.plot_size.y);
+
+		if (!axis.gpu && !axis.monitor && !axis.frame)
+			lanes[axis.pid] = &axis;
+	}
+
+	if (lanes.empty())
+		return;
+
+	ImDrawList *list = ImGui::GetWindowDrawList();
+	list->PushClipRect(clip_min, clip_max, true);
+
+	for (size_t i = 1; i < plot_.path.size(); ++i) {
+		struct path_segment *prev = &plot_.path[i - 1];
+		struct path_segment *s = &plot_.path[i];
+
+		if (prev->pid == s->pid)
+			continue;
+
+		auto from = lanes.find(prev->pid);
+		auto to = lanes.find(s->pid);
+		if (from == lanes.end() || to == lanes.end())
+			continue;
+
+		double y = y_high_ + path_band_ / 2;
+		ImVec2 p0 = get_lane_pos(from->second, prev->stop, y);
+		ImVec2 p1 = get_lane_pos(to->second, s->start, y);
+
+		if (p0.x < clip_min.x || p0.x > clip_max.x)
+			continue;
+
+		list->AddLine(p0, p1, path_color_, 2);
+		list->AddCircleFilled(p1, 3, path_color_);
+	}
+
+	list->PopClipRect();
+}
+
+/* one walk over visible slices per task, prefix sums give run time of
+ * every column
+ */
+static void fill_heatmap(size_t r0, size_t r1)
+{
+	struct heatmap *map = &plot_.heatmap;
+	std::vector<float> sum(map->w);
+	double px = (map->max - map->min) / map->w;
+	size_t n = map->rows.size();
+
+	for (size_t r = r0; r < r1; ++r) {
+		size_t g0 = r * n / map->h;
+		size_t g1 = (r + 1) * n / map->h;
+
+		std::fill(sum.begin(), sum.end(), 0);
+
+		for (size_t g = g0; g < g1; ++g) {
+			struct run_index *idx;
+
+			/* cursor starts at the first slice ending in view */
+			idx = &plot_.y_axes[map->rows[g]].run_index;
+			size_t k = std::upper_bound(idx->stop.begin(),
+			 idx->stop.end(), map->min) - idx->stop.begin();
+			double prev = get_run_before(idx, map->min, &k);
+
+			for (int c = 0; c < map->w; ++c) {
+				double t = map->min + (c + 1) * px;
+				double run = get_run_before(idx, t, &k);
+
+				sum[c] += run - prev;
+				prev = run;
+			}
+		}
+
+		uint32_t *row = &map->pixels[r * map->w];
+		double scale = 255 / (px * (g1 - g0));
+
+		for (int c = 0; c < map->w; ++c)
+			row[c] = map->lut[std::min(int(sum[c] * scale), 255)];
+	}
+}
+
+/* pixel rows are spread over threads, each one owns its rows */
+static void update_heatmap(double min, double max, int w, int h)
+{
+	struct heatmap *map = &plot_.heatmap;
+
+	if (!map->lut[0]) {
+		for (uint16_t i = 0; i < 256; ++i) {
+			map->lut[i] = ImPlot::SampleColormapU32(i / 255.,
+			 ImPlotColormap_Hot);
+		}
+	}
+
+	map->min = min;
+	map->max = max;
+	map->w = w;
+	map->h = h;
+	map->pixels.resize(w * h);
+
+	parallel_for(h, [](size_t r) { fill_heatmap(r, r + 1); }, 8);
+
+	map->dirty = true;
+}
+
+/* selected tasks as rows of one plot instead of a subplot each */
+static void show_heatmap(void)
+{
+	struct heatmap *map = &plot_.heatmap;
+	std::vector<uint16_t> rows;
+
+	for (size_t i = 0; i < plot_.y_axes.size(); ++i) {
+		struct y_axis *axis = &plot_.y_axes[i];
+
+		if (axis->selected && !axis->gpu && !axis->monitor &&
+		 !axis->frame && axis->run_index.start.size())
+			rows.push_back(i);
+	}
+
+	if (rows.empty())
+		return;
+	else if (!ImPlot::BeginPlot("##heatmap", ImVec2(-1, -50), plot_flags_))
+		return;
+
+	ImPlot::SetupAxes("", nullptr, x_flags_, y_flags_);
+	ImPlot::SetupAxesLimits2(0, plot_.max_x, 0, rows.size(),
+	 ImPlotCond_Once, ImPlotCond_Always);
+	ImPlot::SetupAxisFormat(ImAxis_Y1, "");
+
+	if (plot_.set_view) {
+		ImPlot::SetupAxisLimits(ImAxis_X1, plot_.view_min,
+		 plot_.view_max, ImPlotCond_Always);
+	}
+
+	ImPlotRect lim = ImPlot::GetPlotLimits();
+	ImVec2 size = ImPlot::GetPlotSize();
+	int w = size.x;
+	int h = std::min((int) rows.size(), (int) size.y);
+
+	if (rows != map->rows) {
+		map->rows = std::move(rows);
+		map->w = 0; /* force update */
+	}
+
+	if (w > 0 && h > 0 && (w != map->w || h != map->h ||
+	 lim.X.Min != map->min || lim.X.Max != map->max))
+		update_heatmap(lim.X.Min, lim.X.Max, w, h);
+
+	if (map->dirty && plot_.upload_texture) {
+		map->tex = plot_.upload_texture(map->pixels.data(), map->w,
+		 map->h);
+		map->dirty = false;
+	}
+
+	size_t n = map->rows.size();
+
+	if (map->tex) {
+		ImPlot::PlotImage("##heatmap", map->tex,
+		 ImPlotPoint(map->min, 0), ImPlotPoint(map->max, n));
+	}
+
+	if (ImPlot::IsPlotHovered()) {
+		ImPlotPoint mouse = ImPlot::GetPlotMousePos();
+		double px = lim.X.Size() / size.x;
+		double row = n - mouse.y;
+
+		if (row >= 0 && row < n) {
+			struct y_axis *axis = &plot_.y_axes[map->rows[(size_t) row]];
+
+			ImGui::SetTooltip("%s\n%.1f%%", axis->name.c_str(),
+			 get_utilization(&axis->run_index, mouse.x,
+			 mouse.x + px) * 100);
+		}
+	}
+
+	ImPlot::EndPlot();
+}
+
+static void show_task_stats(struct y_axis *axis)
+{
+	ImGui::BeginTooltip();
+	ImGui::Text("run %.3f s", axis->run_time);
+
+	if (plot_.max_khz) {
+		ImGui::Text("at max freq %.3f s (%.0f%%)", axis->work_time,
+		 axis->work_time / axis->run_time * 100);
+	}
+
+	ImGui::Text("migrations %zu, %.1f/s", axis->migrations.size(),
+	 axis->migration_rate);
+
+	for (size_t cpu = 0; cpu < axis->cpu_time.size(); ++cpu) {
+		float share = axis->cpu_time[cpu] / axis->run_time;
+
+		if (axis->cpu_time[cpu] <= 0)
+			continue;
+
+		ImGui::Text("cpu%-3zu %6.2f%%", cpu, share * 100);
+		ImGui::SameLine();
+		ImGui::ProgressBar(share, ImVec2(100, 0), "");
+	}
+
+	ImGui::EndTooltip();
+}
+
 static inline void show_view(void)
 {
 	if (!ImGui::BeginTable("controls", 4, table_flags1_, ImVec2( -1, 0)))
@@ -1289,6 +4344,46 @@ static inline void show_view(void)
 	ImGui::Checkbox("Enable marker info ", &plot_.enable_marker_info);
 	ImGui::TableSetColumnIndex(1);
 	ImGui::Checkbox("Enable process info ", &plot_.enable_procinfo);
+	ImGui::TableSetColumnIndex(2);
+	ImGui::SetNextItemWidth(100);
+	if (ImGui::SliderFloat("Jank x ", &plot_.jank_factor, 1, 4, "%.1f"))
+		update_jank();
+	ImGui::TableSetColumnIndex(3);
+	ImGui::SetNextItemWidth(100);
+	if (ImGui::InputFloat("Target ms (0 median) ", &plot_.target_ms, 0, 0,
+	 "%.2f"))
+		update_jank();
+
+	ImGui::TableNextRow();
+	ImGui::TableSetColumnIndex(0);
+	ImGui::Checkbox("Show flows ", &plot_.show_flows);
+	ImGui::TableSetColumnIndex(1);
+	if (ImGui::Button(" Clear path "))
+		plot_.path.clear();
+	ImGui::TableSetColumnIndex(2);
+	if (plot_.path.size()) {
+		ImGui::Text(" Path %.3f ms: run %.3f wait %.3f blocked %.3f, "
+		 "%u tasks ", (plot_.path_stop - plot_.path_start) * 1e3,
+		 plot_.path_run * 1e3, plot_.path_wait * 1e3,
+		 plot_.path_blocked * 1e3, plot_.path_tasks);
+	} else {
+		ImGui::TextDisabled(" Shift-click: critical path, "
+		 "middle drag: range stats ");
+	}
+	ImGui::TableSetColumnIndex(3);
+	ImGui::Checkbox("Show IRQs ", &plot_.show_irqs);
+
+	ImGui::TableNextRow();
+	ImGui::TableSetColumnIndex(0);
+	ImGui::Checkbox("Show utilization ", &plot_.show_util);
+	ImGui::TableSetColumnIndex(1);
+	ImGui::SetNextItemWidth(100);
+	ImGui::InputFloat("Bucket ms (0 pixel) ", &plot_.util_bucket_ms, 0, 0,
+	 "%.3f");
+	ImGui::TableSetColumnIndex(2);
+	ImGui::Checkbox("Span stats ", &plot_.show_span_stats);
+	ImGui::TableSetColumnIndex(3);
+	ImGui::Checkbox("Heatmap ", &plot_.show_heatmap);
 
         ImGui::EndTable();
 
@@ -1304,6 +4399,9 @@ static inline void show_view(void)
 		for (auto &axis : plot_.y_axes) {
 			ImGui::Selectable(axis.list_name, &axis.selected);
 			rows += axis.selected;
+
+			if (axis.run_time > 0 && ImGui::IsItemHovered())
+				show_task_stats(&axis);
 		}
 
 		ImGui::EndListBox();
@@ -1314,8 +4412,12 @@ static inline void show_view(void)
 	ImPlotSubplotFlags flags = ImPlotSubplotFlags_LinkRows |
 	 ImPlotSubplotFlags_NoMenus;
 
-	if (!rows)
+	if (!rows) {
 		goto out;
+	} else if (plot_.show_heatmap) {
+		show_heatmap();
+		goto out;
+	}
 
 	if (plot_.link_axes)
 		flags |= ImPlotSubplotFlags_LinkAllX;
@@ -1329,6 +4431,8 @@ static inline void show_view(void)
 	}
 
 	show_plot(&plot_.y_axes[plot_.gpu_plot_id]);
+	show_flows();
+	show_path();
 
 	ImPlot::EndSubplots();
 out:
@@ -1340,6 +4444,100 @@ out:
         ImGui::EndTable();
 }
 
+static void show_range_stats(void)
+{
+	double len = plot_.range_max - plot_.range_min;
+
+	ImGui::SetNextWindowSize(ImVec2(600, 400), ImGuiCond_FirstUseEver);
+	if (!ImGui::Begin("Range", &plot_.range_valid)) {
+		ImGui::End();
+		return;
+	}
+
+	ImGui::Text("%f .. %f, %.3f ms", plot_.range_min, plot_.range_max,
+	 len * 1e3);
+
+	if (ImGui::BeginTable("tasks", 7, table_flags2_)) {
+		ImGui::TableSetupColumn("task");
+		ImGui::TableSetupColumn("run ms");
+		ImGui::TableSetupColumn("run %");
+		ImGui::TableSetupColumn("slices");
+		ImGui::TableSetupColumn("mean ms");
+		ImGui::TableSetupColumn("max ms");
+		ImGui::TableSetupColumn("off-cpu ms");
+		ImGui::TableHeadersRow();
+
+		for (auto &stats : plot_.range_stats) {
+			ImGui::TableNextRow();
+			ImGui::TableNextColumn();
+			ImGui::Text("%s", plot_.y_axes[stats.axis].name.c_str());
+			ImGui::TableNextColumn();
+			ImGui::Text("%.3f", stats.run * 1e3);
+			ImGui::TableNextColumn();
+			ImGui::Text("%.1f", stats.run / len * 100);
+			ImGui::TableNextColumn();
+			ImGui::Text("%zu", stats.slices);
+			ImGui::TableNextColumn();
+			ImGui::Text("%.3f", stats.run / stats.slices * 1e3);
+			ImGui::TableNextColumn();
+			ImGui::Text("%.3f", stats.max * 1e3);
+			ImGui::TableNextColumn();
+			ImGui::Text("%.3f", (len - stats.run) * 1e3);
+		}
+
+		ImGui::EndTable();
+	}
+
+	for (size_t cpu = 0; cpu < plot_.range_cpus.size(); ++cpu) {
+		float util = plot_.range_cpus[cpu] / len;
+
+		ImGui::Text("cpu%-3zu %6.2f%%", cpu, util * 100);
+		ImGui::SameLine();
+		ImGui::ProgressBar(util, ImVec2(200, 0), "");
+	}
+
+	ImGui::End();
+}
+
+static void show_span_stats(void)
+{
+	ImGui::SetNextWindowSize(ImVec2(600, 400), ImGuiCond_FirstUseEver);
+	if (!ImGui::Begin("Spans", &plot_.show_span_stats)) {
+		ImGui::End();
+		return;
+	}
+
+	if (ImGui::BeginTable("spans", 6, table_flags2_)) {
+		ImGui::TableSetupColumn("name");
+		ImGui::TableSetupColumn("count");
+		ImGui::TableSetupColumn("mean ms");
+		ImGui::TableSetupColumn("p99 ms");
+		ImGui::TableSetupColumn("max ms");
+		ImGui::TableSetupColumn("total ms");
+		ImGui::TableHeadersRow();
+
+		for (auto &stats : plot_.span_stats) {
+			ImGui::TableNextRow();
+			ImGui::TableNextColumn();
+			ImGui::Text("%s", stats.name);
+			ImGui::TableNextColumn();
+			ImGui::Text("%zu", stats.count);
+			ImGui::TableNextColumn();
+			ImGui::Text("%.3f", stats.mean);
+			ImGui::TableNextColumn();
+			ImGui::Text("%.3f", stats.p99);
+			ImGui::TableNextColumn();
+			ImGui::Text("%.3f", stats.max);
+			ImGui::TableNextColumn();
+			ImGui::Text("%.3f", stats.total);
+		}
+
+		ImGui::EndTable();
+	}
+
+	ImGui::End();
+}
+
 static void plot(double w, double h)
 {
 	static bool p_open;
@@ -1349,12 +4547,23 @@ static void plot(double w, double h)
 	if (!ImGui::Begin("Ftrace viewer", &p_open, win_flags_))
 		return;
 
+	plot_.frame++;
 	show_view();
+	trim_pages(plot_.frame);
 	plot_.event = false;
+	plot_.path_event = false;
 	plot_.reset_labels = false;
+	plot_.set_view = plot_.jump_view;
+	plot_.jump_view = false;
 	x_flags_ &= ~ImPlotAxisFlags_AutoFit; /* only need it once */
 
 	ImGui::End();
+
+	if (plot_.range_valid)
+		show_range_stats();
+
+	if (plot_.show_span_stats)
+		show_span_stats();
 }
 
 #endif /* FTRACE_PLOTTER_H_ */
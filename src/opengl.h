@@ -31,10 +31,37 @@ static void cleanup_gui(void)
         ImGui::DestroyContext();
 }
 
+/* one texture is enough, it is only used for heatmap */
+static ImTextureID upload_texture(const uint32_t *pixels, int w, int h)
+{
+	static GLuint tex;
+
+	if (!tex) {
+		glGenTextures(1, &tex);
+		glBindTexture(GL_TEXTURE_2D, tex);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S,
+		 GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T,
+		 GL_CLAMP_TO_EDGE);
+	}
+
+	glBindTexture(GL_TEXTURE_2D, tex);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA,
+	 GL_UNSIGNED_BYTE, pixels);
+
+	return (ImTextureID) (intptr_t) tex;
+}
+
 static bool init_gui_backend(void)
 {
 	ImGui_ImplGlfw_InitForOpenGL(win_, true);
 	ImGui_ImplOpenGL3_Init("#version 150");
+#ifdef FTRACE_PLOTTER_H_
+	plot_.upload_texture = upload_texture;
+#endif
 	return true;
 }
 
@@ -0,0 +1,444 @@
+#ifndef PAGES_H_
+#define PAGES_H_
+
+/* Temporary file for arrays which don't have to stay in memory.
+ *
+ * Arrays are streamed to an unlinked file while they grow: paged_array
+ * writes its items out every time a chunk worth of them is collected. Once
+ * complete, array is put together in one piece by pack_array() and used in
+ * place from a shared mapping. Mapping lives in address space reserved up
+ * front, so it grows with map_pages() without moving arrays mapped earlier.
+ *
+ * Mapping is cut into chunks; users report chunks they access with
+ * touch_pages() and trim_pages() drops least recently used ones once more
+ * than budget bytes are resident, less the pinned bytes users keep in
+ * memory on the side. Dropped chunks are read back from file on
+ * next access. Pages faulted in without touch_pages(), e.g. by binary
+ * searches, are picked up every scan_frames_ frames by checking residency
+ * with mincore().
+ *
+ * Writes, packing and mapping are serialized, so arrays can be streamed
+ * from pool threads as long as every array is owned by one thread.
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <mutex>
+#include <atomic>
+
+constexpr size_t page_chunk_ = 256 << 10; /* bytes, multiple of page size */
+constexpr size_t page_align_ = 64; /* array offsets */
+constexpr size_t page_reserve_ = (size_t) 1 << 40; /* address space */
+constexpr uint64_t scan_frames_ = 64;
+
+struct pages {
+	int fd = -1;
+	char *base = nullptr; /* page_reserve_ bytes, file mapped from start */
+	size_t size = 0; /* bytes written */
+	size_t mapped = 0; /* bytes mapped */
+	size_t freed = 0; /* bytes of holes left by packing */
+	size_t budget = 0; /* bytes, 0 means arrays stay in memory */
+	size_t resident = 0; /* bytes in chunks touched and not dropped */
+	size_t pinned = 0; /* bytes kept in memory instead of file */
+	std::vector<uint64_t> used; /* frame chunk was last touched, 0 if not */
+	uint64_t scan_frame = 0;
+	std::recursive_mutex lock; /* writes, packing and mapping */
+	std::atomic<bool> failed{false}; /* streamed array was not written */
+
+	~pages()
+	{
+		if (base)
+			munmap(base, page_reserve_);
+		if (fd >= 0)
+			close(fd);
+	}
+};
+
+static struct pages pages_;
+
+/* file goes to TMPDIR or /var/tmp which is less likely to be in memory
+ * than /tmp
+ */
+static bool open_pages(size_t budget)
+{
+	const char *dir = getenv("TMPDIR");
+	std::string path = std::string(dir ? dir : "/var/tmp") +
+	 "/ftrace-viewer-XXXXXX";
+
+	if ((pages_.fd = mkstemp(&path[0])) < 0)
+		return false;
+
+	unlink(path.c_str());
+	pages_.budget = budget;
+	return true;
+}
+
+static inline size_t get_pages_end(void)
+{
+	return (pages_.size + page_align_ - 1) & ~(page_align_ - 1);
+}
+
+/* returns offset of data in file or SIZE_MAX on error */
+static size_t write_pages(const void *data, size_t len)
+{
+	std::lock_guard<std::recursive_mutex> l(pages_.lock);
+	size_t off = get_pages_end();
+	const char *ptr = (const char *) data;
+
+	if (!len)
+		return off;
+
+	for (size_t n = 0; n < len;) {
+		ssize_t ret = pwrite(pages_.fd, ptr + n, len - n, off + n);
+		if (ret <= 0)
+			return SIZE_MAX;
+
+		n += ret;
+	}
+
+	pages_.size = off + len;
+	return off;
+}
+
+/* appends copy of len bytes at off, returns offset of copy or SIZE_MAX on
+ * error; data stays in kernel unless file system can't copy
+ */
+static size_t copy_pages(size_t off, size_t len)
+{
+	std::lock_guard<std::recursive_mutex> l(pages_.lock);
+	static std::vector<char> buf;
+	size_t dst = get_pages_end();
+	loff_t in = off;
+	loff_t out = dst;
+
+	while (len) {
+		ssize_t ret = copy_file_range(pages_.fd, &in, pages_.fd, &out,
+		 len, 0);
+		if (ret <= 0)
+			break;
+
+		len -= ret;
+	}
+
+	buf.resize(page_chunk_);
+	while (len) {
+		size_t n = std::min(len, buf.size());
+
+		if (pread(pages_.fd, buf.data(), n, in) != (ssize_t) n)
+			return SIZE_MAX;
+		else if (pwrite(pages_.fd, buf.data(), n, out) != (ssize_t) n)
+			return SIZE_MAX;
+
+		in += n;
+		out += n;
+		len -= n;
+	}
+
+	pages_.size = out;
+	return dst;
+}
+
+/* space of data copied elsewhere goes back to file system */
+static void free_pages(size_t off, size_t len)
+{
+	std::lock_guard<std::recursive_mutex> l(pages_.lock);
+
+	fallocate(pages_.fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, off,
+	 len);
+	pages_.freed += len;
+}
+
+/* maps data written since last call right after the mapped part */
+static bool map_pages(void)
+{
+	std::lock_guard<std::recursive_mutex> l(pages_.lock);
+	size_t from = pages_.mapped & ~(sysconf(_SC_PAGESIZE) - 1);
+
+	if (pages_.size == pages_.mapped)
+		return true;
+	else if (pages_.size > page_reserve_)
+		return false;
+
+	if (!pages_.base) {
+		void *base = mmap(nullptr, page_reserve_, PROT_NONE,
+		 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+		if (base == MAP_FAILED)
+			return false;
+
+		pages_.base = (char *) base;
+	}
+
+	void *ptr = mmap(pages_.base + from, pages_.size - from,
+	 PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, pages_.fd, from);
+
+	if (ptr == MAP_FAILED)
+		return false;
+
+	pages_.mapped = pages_.size;
+	pages_.used.resize((pages_.size + page_chunk_ - 1) / page_chunk_);
+	return true;
+}
+
+/* vector which is written out a chunk at a time as it grows when there is
+ * a file; written items can be accessed only once array is mapped
+ */
+template <typename T>
+struct paged_array {
+	std::vector<T> vec; /* items not written yet */
+	std::vector<std::pair<size_t, size_t>> runs; /* offset, count */
+	size_t paged = 0; /* items in runs */
+	T *map = nullptr;
+	size_t map_size = 0;
+
+	/* whole multiple of page_align_ bytes, so runs pack without gaps */
+	static constexpr size_t chunk_items = page_chunk_ / sizeof(T) /
+	 page_align_ * page_align_;
+
+	size_t size() const { return map ? map_size : paged + vec.size(); }
+	bool empty() const { return !size(); }
+	T *begin() { return map ? map : vec.data(); }
+	T *end() { return begin() + size(); }
+	T &front() { return *begin(); }
+	T &back() { return end()[-1]; }
+	T &operator[](size_t i) { return begin()[i]; }
+	void resize(size_t n) { vec.resize(n); }
+
+	void push_back(const T &item)
+	{
+		vec.push_back(item);
+
+		if (pages_.fd >= 0 && vec.size() == chunk_items)
+			write();
+	}
+
+	void write(void)
+	{
+		size_t off;
+
+		if (pages_.failed)
+			return;
+
+		off = write_pages(vec.data(), vec.size() * sizeof(T));
+		if (off == SIZE_MAX) {
+			pages_.failed = true;
+			return;
+		}
+
+		runs.push_back({ off, vec.size() });
+		paged += vec.size();
+		vec.clear();
+	}
+};
+
+/* runs are copied one after another to the end of file, followed by items
+ * still in memory; returns offset of the whole array or SIZE_MAX on error
+ */
+template <typename T>
+static size_t pack_array(struct paged_array<T> *array)
+{
+	std::lock_guard<std::recursive_mutex> l(pages_.lock);
+	size_t off = SIZE_MAX;
+
+	if (pages_.failed)
+		return SIZE_MAX;
+	else if (array->runs.size() == 1 && array->vec.empty())
+		return array->runs[0].first;
+
+	for (auto &run : array->runs) {
+		size_t len = run.second * sizeof(T);
+		size_t dst = copy_pages(run.first, len);
+
+		if (dst == SIZE_MAX)
+			return SIZE_MAX;
+		else if (off == SIZE_MAX)
+			off = dst;
+
+		free_pages(run.first, len);
+	}
+
+	size_t dst = write_pages(array->vec.data(),
+	 array->vec.size() * sizeof(T));
+
+	if (dst == SIZE_MAX)
+		return SIZE_MAX;
+
+	return off == SIZE_MAX ? dst : off;
+}
+
+/* array packed at off is used from mapping, empty one stays as is */
+template <typename T>
+static void map_array(struct paged_array<T> *array, size_t off)
+{
+	if (array->empty())
+		return;
+
+	array->map_size = array->size();
+	array->map = (T *) (pages_.base + off);
+	std::vector<T>().swap(array->vec);
+	std::vector<std::pair<size_t, size_t>>().swap(array->runs);
+}
+
+/* arrays of one owner, e.g. run index of a lane, go to mapping together;
+ * without file they stay in memory, failure is kept in pages_.failed
+ */
+template <typename... T>
+static bool page_arrays(struct paged_array<T> *...arrays)
+{
+	if (pages_.fd < 0)
+		return true;
+
+	size_t offsets[] = { pack_array(arrays)... };
+	size_t i = 0;
+
+	for (size_t off : offsets) {
+		if (off == SIZE_MAX) {
+			pages_.failed = true;
+			return false;
+		}
+	}
+
+	if (!map_pages()) {
+		pages_.failed = true;
+		return false;
+	}
+
+	(map_array(arrays, offsets[i++]), ...);
+	return true;
+}
+
+/* pages of array are taken out of process once a pass is done reading
+ * it, contents stay in page cache or file
+ */
+template <typename T>
+static void drop_array(struct paged_array<T> *array)
+{
+	uintptr_t from = (uintptr_t) array->map & ~(sysconf(_SC_PAGESIZE) - 1);
+	uintptr_t to = (uintptr_t) (array->map + array->map_size);
+
+	if (array->map)
+		madvise((void *) from, to - from, MADV_DONTNEED);
+}
+
+static inline size_t get_chunk_size(size_t c)
+{
+	return std::min(page_chunk_, pages_.size - c * page_chunk_);
+}
+
+static void touch_pages(const void *ptr, size_t len, uint64_t frame)
+{
+	size_t off = (const char *) ptr - pages_.base;
+
+	if (!pages_.base || !len)
+		return;
+
+	for (size_t c = off / page_chunk_; c <= (off + len - 1) / page_chunk_;
+	 ++c) {
+		if (!pages_.used[c])
+			pages_.resident += get_chunk_size(c);
+
+		pages_.used[c] = frame;
+	}
+}
+
+/* every page is taken out of process, e.g. whatever loading passes read,
+ * so only what gets drawn comes back
+ */
+static void drop_pages(void)
+{
+	if (!pages_.base)
+		return;
+
+	msync(pages_.base, pages_.mapped, MS_SYNC);
+	madvise(pages_.base, pages_.mapped, MADV_DONTNEED);
+	posix_fadvise(pages_.fd, 0, pages_.mapped, POSIX_FADV_DONTNEED);
+
+	std::fill(pages_.used.begin(), pages_.used.end(), 0);
+	pages_.resident = 0;
+}
+
+/* chunks with resident pages nobody reported count as least recently used;
+ * residency of the whole mapping is taken with one mincore() call
+ */
+static void scan_pages(void)
+{
+	static std::vector<unsigned char> vec;
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t chunk_pages = page_chunk_ / page;
+
+	vec.resize((pages_.size + page - 1) / page);
+	if (mincore(pages_.base, pages_.size, vec.data()))
+		return;
+
+	for (size_t c = 0; c < pages_.used.size(); ++c) {
+		auto first = vec.begin() + c * chunk_pages;
+		auto last = vec.begin() + std::min(vec.size(),
+		 (c + 1) * chunk_pages);
+
+		if (pages_.used[c])
+			continue;
+		else if (std::none_of(first, last,
+		 [](unsigned char v) { return v & 1; }))
+			continue;
+
+		pages_.used[c] = 1;
+		pages_.resident += get_chunk_size(c);
+	}
+}
+
+/* chunks touched in current frame are never dropped, so budget can be
+ * exceeded by a single view
+ */
+static void trim_pages(uint64_t frame)
+{
+	std::vector<size_t> chunks;
+
+	if (!pages_.base)
+		return;
+
+	if (frame - pages_.scan_frame >= scan_frames_) {
+		pages_.scan_frame = frame;
+		scan_pages();
+	}
+
+	size_t budget = pages_.budget > pages_.pinned ?
+	 pages_.budget - pages_.pinned : 0;
+
+	if (pages_.resident <= budget)
+		return;
+
+	for (size_t c = 0; c < pages_.used.size(); ++c) {
+		if (pages_.used[c] && pages_.used[c] < frame)
+			chunks.push_back(c);
+	}
+
+	std::sort(chunks.begin(), chunks.end(), [](size_t a, size_t b) {
+		return pages_.used[a] < pages_.used[b];
+	});
+
+	for (size_t c : chunks) {
+		char *ptr = pages_.base + c * page_chunk_;
+		size_t len = get_chunk_size(c);
+
+		if (pages_.resident <= budget)
+			break;
+
+		/* labels toggled by clicks make pages dirty */
+		msync(ptr, len, MS_SYNC);
+		madvise(ptr, len, MADV_DONTNEED);
+		posix_fadvise(pages_.fd, c * page_chunk_, len,
+		 POSIX_FADV_DONTNEED);
+
+		pages_.used[c] = 0;
+		pages_.resident -= len;
+	}
+}
+
+#endif /* PAGES_H_ */
@@ -0,0 +1,169 @@
+#ifndef POOL_H_
+#define POOL_H_
+
+/* Work-stealing pool for loops over independent items.
+ *
+ * parallel_for() cuts [0, n) into chunks dealt round-robin to per-thread
+ * queues; every thread takes chunks from the front of its own queue and
+ * steals from the back of the others once it runs dry. Calling thread
+ * works too and returns when all chunks are done.
+ *
+ * Items must only write their own results, then output doesn't depend on
+ * which thread ran what. Loop body must not call parallel_for() itself.
+ */
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <atomic>
+#include <functional>
+
+typedef std::function<void(size_t)> pool_fn;
+
+struct pool_range {
+	size_t begin;
+	size_t end;
+};
+
+struct pool_queue {
+	std::mutex lock;
+	std::deque<struct pool_range> ranges;
+};
+
+struct pool {
+	std::vector<std::thread> threads;
+	std::vector<struct pool_queue> queues; /* last one is caller's */
+	std::mutex lock;
+	std::condition_variable wake;
+	std::condition_variable done;
+	const pool_fn *fn = nullptr;
+	std::atomic<size_t> pending{0}; /* chunks not done yet */
+	uint64_t job = 0;
+	bool stop = false;
+
+	~pool()
+	{
+		{
+			std::lock_guard<std::mutex> l(lock);
+			stop = true;
+		}
+
+		wake.notify_all();
+		for (auto &t : threads)
+			t.join();
+	}
+};
+
+static struct pool pool_;
+
+static inline bool pool_take(size_t self, struct pool_range *r)
+{
+	size_t n = pool_.queues.size();
+
+	for (size_t i = 0; i < n; ++i) {
+		struct pool_queue *q = &pool_.queues[(self + i) % n];
+		std::lock_guard<std::mutex> l(q->lock);
+
+		if (q->ranges.empty())
+			continue;
+
+		if (i == 0) {
+			*r = q->ranges.front();
+			q->ranges.pop_front();
+		} else {
+			*r = q->ranges.back(); /* steal */
+			q->ranges.pop_back();
+		}
+
+		return true;
+	}
+
+	return false;
+}
+
+static void pool_run(size_t self)
+{
+	struct pool_range r;
+
+	while (pool_take(self, &r)) {
+		for (size_t i = r.begin; i < r.end; ++i)
+			(*pool_.fn)(i);
+
+		if (pool_.pending.fetch_sub(1) == 1) {
+			std::lock_guard<std::mutex> l(pool_.lock);
+			pool_.done.notify_all();
+		}
+	}
+}
+
+static void pool_worker(size_t self)
+{
+	uint64_t job = 0;
+
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> l(pool_.lock);
+			pool_.wake.wait(l, [&] {
+				return pool_.stop || pool_.job != job;
+			});
+
+			if (pool_.stop)
+				return;
+
+			job = pool_.job;
+		}
+
+		pool_run(self);
+	}
+}
+
+static void init_pool(void)
+{
+	size_t n = std::max(1u, std::thread::hardware_concurrency());
+
+	pool_.queues = std::vector<struct pool_queue>(n);
+	for (size_t i = 0; i + 1 < n; ++i)
+		pool_.threads.emplace_back(pool_worker, i);
+}
+
+/* chunks of grain items; small loops run on calling thread only */
+static void parallel_for(size_t n, const pool_fn &fn, size_t grain = 1)
+{
+	size_t chunks = (n + grain - 1) / grain;
+
+	if (pool_.queues.empty())
+		init_pool();
+
+	if (chunks < 2 || pool_.threads.empty()) {
+		for (size_t i = 0; i < n; ++i)
+			fn(i);
+		return;
+	}
+
+	/* fn and pending are published by queue locks along with chunks */
+	pool_.fn = &fn;
+	pool_.pending = chunks;
+
+	for (size_t c = 0; c < chunks; ++c) {
+		struct pool_queue *q = &pool_.queues[c % pool_.queues.size()];
+		std::lock_guard<std::mutex> l(q->lock);
+
+		q->ranges.push_back({ c * grain, std::min(n, (c + 1) * grain) });
+	}
+
+	{
+		std::lock_guard<std::mutex> l(pool_.lock);
+		pool_.job++;
+	}
+
+	pool_.wake.notify_all();
+	pool_run(pool_.queues.size() - 1);
+
+	std::unique_lock<std::mutex> l(pool_.lock);
+	pool_.done.wait(l, [] { return pool_.pending == 0; });
+	pool_.fn = nullptr;
+}
+
+#endif /* POOL_H_ */
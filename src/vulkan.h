@@ -15,6 +15,24 @@ struct context {
 
 static struct context ctx_;
 
+/* heatmap texture, recreated when its size changes */
+struct texture {
+	VkImage image = VK_NULL_HANDLE;
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkImageView view = VK_NULL_HANDLE;
+	VkSampler sampler = VK_NULL_HANDLE;
+	VkDescriptorSet set = VK_NULL_HANDLE;
+	VkBuffer staging = VK_NULL_HANDLE;
+	VkDeviceMemory staging_memory = VK_NULL_HANDLE;
+	VkCommandPool cmdpool = VK_NULL_HANDLE;
+	VkCommandBuffer cmdbuf = VK_NULL_HANDLE;
+	int w = 0;
+	int h = 0;
+	bool ready = false; /* has pixels, i.e. shader read layout */
+};
+
+static struct texture tex_;
+
 static inline bool is_minimized(ImDrawData *data)
 {
 	return (data->DisplaySize.x <= 0. || data->DisplaySize.y <= 0.);
@@ -224,6 +242,292 @@ static void cleanup_vulkan(void)
 	vkDestroyInstance(ctx_.vk_instance, ctx_.vk_alloctor);
 }
 
+static VkResult alloc_memory(VkMemoryRequirements *req,
+ VkMemoryPropertyFlags props, VkDeviceMemory *memory)
+{
+	VkResult err;
+	VkPhysicalDeviceMemoryProperties mem;
+	VkMemoryAllocateInfo info = {};
+
+	info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	info.allocationSize = req->size;
+	info.memoryTypeIndex = UINT32_MAX;
+
+	vkGetPhysicalDeviceMemoryProperties(ctx_.vk_gpu, &mem);
+	for (uint32_t i = 0; i < mem.memoryTypeCount; ++i) {
+		if ((req->memoryTypeBits & (1 << i)) &&
+		 (mem.memoryTypes[i].propertyFlags & props) == props) {
+			info.memoryTypeIndex = i;
+			break;
+		}
+	}
+
+	if (info.memoryTypeIndex == UINT32_MAX) {
+		ee("no suitable memory type\n");
+		return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+	}
+
+	vk_call(err, vkAllocateMemory(ctx_.vk_dev, &info, ctx_.vk_alloctor,
+	 memory));
+	return err;
+}
+
+/* command pool is kept for the next texture */
+static void destroy_texture(void)
+{
+	VkCommandPool cmdpool = tex_.cmdpool;
+	VkCommandBuffer cmdbuf = tex_.cmdbuf;
+
+	if (tex_.set) {
+		vkFreeDescriptorSets(ctx_.vk_dev, ctx_.vk_descriptor_pool, 1,
+		 &tex_.set);
+	}
+
+	vkDestroySampler(ctx_.vk_dev, tex_.sampler, ctx_.vk_alloctor);
+	vkDestroyImageView(ctx_.vk_dev, tex_.view, ctx_.vk_alloctor);
+	vkDestroyImage(ctx_.vk_dev, tex_.image, ctx_.vk_alloctor);
+	vkFreeMemory(ctx_.vk_dev, tex_.memory, ctx_.vk_alloctor);
+	vkDestroyBuffer(ctx_.vk_dev, tex_.staging, ctx_.vk_alloctor);
+	vkFreeMemory(ctx_.vk_dev, tex_.staging_memory, ctx_.vk_alloctor);
+
+	tex_ = texture{};
+	tex_.cmdpool = cmdpool;
+	tex_.cmdbuf = cmdbuf;
+}
+
+static VkResult create_texture_cmdbuf(void)
+{
+	VkResult err;
+
+	VkCommandPoolCreateInfo pool_info = {};
+	pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+	pool_info.queueFamilyIndex = ctx_.vk_queue_family;
+
+	vk_call(err, vkCreateCommandPool(ctx_.vk_dev, &pool_info,
+	 ctx_.vk_alloctor, &tex_.cmdpool));
+	if (err != VK_SUCCESS)
+		return err;
+
+	VkCommandBufferAllocateInfo info = {};
+	info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	info.commandPool = tex_.cmdpool;
+	info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	info.commandBufferCount = 1;
+
+	vk_call(err, vkAllocateCommandBuffers(ctx_.vk_dev, &info,
+	 &tex_.cmdbuf));
+	return err;
+}
+
+static VkResult create_texture(int w, int h)
+{
+	VkResult err;
+	VkMemoryRequirements req;
+
+	if (!tex_.cmdpool && (err = create_texture_cmdbuf()) != VK_SUCCESS)
+		return err;
+
+	VkImageCreateInfo image_info = {};
+	image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	image_info.imageType = VK_IMAGE_TYPE_2D;
+	image_info.format = VK_FORMAT_R8G8B8A8_UNORM;
+	image_info.extent.width = w;
+	image_info.extent.height = h;
+	image_info.extent.depth = 1;
+	image_info.mipLevels = 1;
+	image_info.arrayLayers = 1;
+	image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+	image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+	image_info.usage = VK_IMAGE_USAGE_SAMPLED_BIT |
+	 VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+	image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+	vk_call(err, vkCreateImage(ctx_.vk_dev, &image_info, ctx_.vk_alloctor,
+	 &tex_.image));
+	if (err != VK_SUCCESS)
+		return err;
+
+	vkGetImageMemoryRequirements(ctx_.vk_dev, tex_.image, &req);
+	err = alloc_memory(&req, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+	 &tex_.memory);
+	if (err != VK_SUCCESS)
+		return err;
+
+	vk_call(err, vkBindImageMemory(ctx_.vk_dev, tex_.image, tex_.memory,
+	 0));
+	if (err != VK_SUCCESS)
+		return err;
+
+	VkImageViewCreateInfo view_info = {};
+	view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	view_info.image = tex_.image;
+	view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	view_info.format = VK_FORMAT_R8G8B8A8_UNORM;
+	view_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	view_info.subresourceRange.levelCount = 1;
+	view_info.subresourceRange.layerCount = 1;
+
+	vk_call(err, vkCreateImageView(ctx_.vk_dev, &view_info,
+	 ctx_.vk_alloctor, &tex_.view));
+	if (err != VK_SUCCESS)
+		return err;
+
+	VkSamplerCreateInfo sampler_info = {};
+	sampler_info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	sampler_info.magFilter = VK_FILTER_NEAREST;
+	sampler_info.minFilter = VK_FILTER_NEAREST;
+	sampler_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	sampler_info.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	sampler_info.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	sampler_info.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	sampler_info.maxAnisotropy = 1;
+
+	vk_call(err, vkCreateSampler(ctx_.vk_dev, &sampler_info,
+	 ctx_.vk_alloctor, &tex_.sampler));
+	if (err != VK_SUCCESS)
+		return err;
+
+	tex_.set = ImGui_ImplVulkan_AddTexture(tex_.sampler, tex_.view,
+	 VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+	VkBufferCreateInfo buf_info = {};
+	buf_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	buf_info.size = (VkDeviceSize) w * h * 4;
+	buf_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	buf_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	vk_call(err, vkCreateBuffer(ctx_.vk_dev, &buf_info, ctx_.vk_alloctor,
+	 &tex_.staging));
+	if (err != VK_SUCCESS)
+		return err;
+
+	vkGetBufferMemoryRequirements(ctx_.vk_dev, tex_.staging, &req);
+	err = alloc_memory(&req, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+	 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &tex_.staging_memory);
+	if (err != VK_SUCCESS)
+		return err;
+
+	vk_call(err, vkBindBufferMemory(ctx_.vk_dev, tex_.staging,
+	 tex_.staging_memory, 0));
+	if (err != VK_SUCCESS)
+		return err;
+
+	tex_.w = w;
+	tex_.h = h;
+	return VK_SUCCESS;
+}
+
+static inline void set_texture_layout(VkImageLayout from, VkImageLayout to,
+ VkAccessFlags src_access, VkAccessFlags dst_access,
+ VkPipelineStageFlags src_stage, VkPipelineStageFlags dst_stage)
+{
+	VkImageMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.oldLayout = from;
+	barrier.newLayout = to;
+	barrier.srcAccessMask = src_access;
+	barrier.dstAccessMask = dst_access;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = tex_.image;
+	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.levelCount = 1;
+	barrier.subresourceRange.layerCount = 1;
+
+	vkCmdPipelineBarrier(tex_.cmdbuf, src_stage, dst_stage, 0, 0, NULL, 0,
+	 NULL, 1, &barrier);
+}
+
+/* synchronous upload; barrier after frames already submitted makes sure
+ * they are done sampling the texture before it gets overwritten
+ */
+static ImTextureID upload_texture(const uint32_t *pixels, int w, int h)
+{
+	VkResult err;
+	void *data;
+	size_t size = (size_t) w * h * 4;
+
+	if (w != tex_.w || h != tex_.h) {
+		/* descriptor set can still be used by frame in flight */
+		vk_call(err, vkDeviceWaitIdle(ctx_.vk_dev));
+		destroy_texture();
+
+		if (create_texture(w, h) != VK_SUCCESS) {
+			destroy_texture();
+			return 0;
+		}
+	}
+
+	vk_call(err, vkMapMemory(ctx_.vk_dev, tex_.staging_memory, 0, size, 0,
+	 &data));
+	if (err != VK_SUCCESS)
+		return 0;
+
+	memcpy(data, pixels, size);
+	vkUnmapMemory(ctx_.vk_dev, tex_.staging_memory);
+
+	VkCommandBufferBeginInfo begin_info = {};
+	begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	vk_call(err, vkBeginCommandBuffer(tex_.cmdbuf, &begin_info));
+	if (err != VK_SUCCESS)
+		return 0;
+
+	if (tex_.ready) {
+		set_texture_layout(VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+		 VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		 VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+		 VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+		 VK_PIPELINE_STAGE_TRANSFER_BIT);
+	} else {
+		set_texture_layout(VK_IMAGE_LAYOUT_UNDEFINED,
+		 VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 0,
+		 VK_ACCESS_TRANSFER_WRITE_BIT,
+		 VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+		 VK_PIPELINE_STAGE_TRANSFER_BIT);
+	}
+
+	VkBufferImageCopy region = {};
+	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	region.imageSubresource.layerCount = 1;
+	region.imageExtent.width = w;
+	region.imageExtent.height = h;
+	region.imageExtent.depth = 1;
+
+	vkCmdCopyBufferToImage(tex_.cmdbuf, tex_.staging, tex_.image,
+	 VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+	set_texture_layout(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+	 VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+	 VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+	 VK_PIPELINE_STAGE_TRANSFER_BIT,
+	 VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+
+	vk_call(err, vkEndCommandBuffer(tex_.cmdbuf));
+	if (err != VK_SUCCESS)
+		return 0;
+
+	VkSubmitInfo info = {};
+	info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	info.commandBufferCount = 1;
+	info.pCommandBuffers = &tex_.cmdbuf;
+
+	vk_call(err, vkQueueSubmit(ctx_.vk_queue, 1, &info, VK_NULL_HANDLE));
+	if (err != VK_SUCCESS)
+		return 0;
+
+	/* staging buffer is reused by the next upload */
+	vk_call(err, vkQueueWaitIdle(ctx_.vk_queue));
+	if (err != VK_SUCCESS)
+		return 0;
+
+	tex_.ready = true;
+	return (ImTextureID) tex_.set;
+}
+
 static void render_frame(ImDrawData *draw_data)
 {
 	VkResult err;
@@ -426,6 +730,9 @@ static bool init_gui_backend(void)
 	info.CheckVkResultFn = vk_result_cb;
 
 	ImGui_ImplVulkan_Init(&info, win->RenderPass);
+#ifdef FTRACE_PLOTTER_H_
+	plot_.upload_texture = upload_texture;
+#endif
 
 	return init_vulkan_font();
 }
@@ -490,6 +797,9 @@ static void cleanup_gui(void)
 	VkResult err;
 	vk_call(err, vkDeviceWaitIdle(ctx_.vk_dev));
 
+	destroy_texture();
+	vkDestroyCommandPool(ctx_.vk_dev, tex_.cmdpool, ctx_.vk_alloctor);
+
 	ImGui_ImplVulkan_Shutdown();
 	ImGui_ImplGlfw_Shutdown();
 	ImPlot::DestroyContext();
@@ -1,28 +1,310 @@
 #ifndef TRACE_H_
 #define TRACE_H_
 
+/* Marker writer for ftrace trace_marker file.
+ *
+ * The marker file is opened once and kept open; every marker is formatted
+ * into a buffer on the caller's stack and goes out with a single write().
+ *
+ * Optionally trace_ring_start() switches to per-thread lock-free rings which
+ * are drained by a helper thread, so the hot path does no syscalls at all.
+ * Note that ftrace stamps a marker when it is written, i.e. in ring mode the
+ * timestamp is the drain time, which is fine for payloads carrying their own
+ * timestamps (e.g. 'gpu,' markers) but not for latency measurements.
+ *
+ * Marker path can be overridden with TRACE_MARKER environment variable, e.g.
+ * a regular file for testing without tracefs.
+ *
+ * State is static, so every program (or shared object) including this header
+ * has its own marker fd and rings.
+ */
+
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 
-#define trace_marker(...) {\
-  FILE *trace_file_ = fopen("/sys/kernel/tracing/trace_marker", "w");\
-  if (trace_file_) {\
-    fprintf(trace_file_, __VA_ARGS__);\
-    fclose(trace_file_);\
-  }\
+#ifndef TRACE_BUF_SIZE
+#define TRACE_BUF_SIZE 256 /* max marker length including '\n' */
+#endif
+
+#ifndef TRACE_RING_SIZE
+#define TRACE_RING_SIZE 256 /* markers per thread, power of two */
+#endif
+
+#ifndef O_CLOEXEC
+#define O_CLOEXEC 0
+#endif
+
+#define TRACE_MARKER_PATH "/sys/kernel/tracing/trace_marker"
+#define TRACE_MARKER_PATH_OLD "/sys/kernel/debug/tracing/trace_marker"
+
+struct trace_ring {
+	struct trace_ring *next;
+	uint32_t head; /* written by owner thread */
+	uint32_t tail; /* written by helper thread */
+	uint8_t used;
+	uint16_t len[TRACE_RING_SIZE];
+	char buf[TRACE_RING_SIZE][TRACE_BUF_SIZE];
+};
+
+static int trace_fd_ = -1;
+static uint8_t trace_ring_on_;
+static uint8_t trace_ring_stop_;
+static uint32_t trace_ring_users_; /* producers between flag check and push */
+static uint64_t trace_dropped_;
+static pthread_t trace_ring_thread_;
+static pthread_key_t trace_ring_key_;
+static pthread_once_t trace_ring_once_ = PTHREAD_ONCE_INIT;
+static int trace_ring_key_err_;
+static struct trace_ring *trace_rings_;
+static __thread struct trace_ring *trace_ring_;
+
+static inline int trace_open(const char *path)
+{
+	int fd = __atomic_load_n(&trace_fd_, __ATOMIC_ACQUIRE);
+	int flags = O_WRONLY | O_APPEND | O_CLOEXEC;
+
+	if (fd >= 0)
+		return fd;
+	else if (!path)
+		path = getenv("TRACE_MARKER");
+
+	if (path) {
+		fd = open(path, flags | O_CREAT, 0644);
+	} else if ((fd = open(TRACE_MARKER_PATH, flags)) < 0) {
+		fd = open(TRACE_MARKER_PATH_OLD, flags);
+	}
+
+	if (fd < 0)
+		return -1;
+
+	int expected = -1;
+	if (!__atomic_compare_exchange_n(&trace_fd_, &expected, fd, 0,
+	 __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		close(fd); /* another thread won */
+		fd = expected;
+	}
+
+	return fd;
 }
 
-#define trace_marker_mon(...) {\
-  FILE *trace_file_ = fopen("/sys/kernel/tracing/trace_marker", "w");\
-  if (trace_file_) {\
-    fprintf(trace_file_, "mon," __VA_ARGS__);\
-    fclose(trace_file_);\
-  }\
+static inline void trace_close(void)
+{
+	int fd = __atomic_exchange_n(&trace_fd_, -1, __ATOMIC_ACQ_REL);
+	if (fd >= 0)
+		close(fd);
+}
+
+static inline int trace_write_str(const char *str, size_t len)
+{
+	int fd = __atomic_load_n(&trace_fd_, __ATOMIC_ACQUIRE);
+	int errno_ = errno;
+
+	if (fd < 0 && (fd = trace_open(NULL)) < 0) {
+		errno = errno_;
+		return -1;
+	}
+
+	ssize_t n = write(fd, str, len);
+	errno = errno_; /* don't mess with traced application */
+	return n == (ssize_t) len ? 0 : -1;
 }
 
+static inline void trace_ring_free(void *arg)
+{
+	struct trace_ring *ring = (struct trace_ring *) arg;
+	__atomic_store_n(&ring->used, 0, __ATOMIC_RELEASE); /* reuse later */
+}
+
+/* per-thread rings are never freed, they are reused by new threads */
+static inline struct trace_ring *trace_ring_get(void)
+{
+	struct trace_ring *ring;
+
+	if (trace_ring_)
+		return trace_ring_;
+
+	ring = __atomic_load_n(&trace_rings_, __ATOMIC_ACQUIRE);
+	for (; ring; ring = ring->next) {
+		uint8_t expected = 0;
+		if (__atomic_compare_exchange_n(&ring->used, &expected, 1, 0,
+		 __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			goto out;
+	}
+
+	if (!(ring = (struct trace_ring *) calloc(1, sizeof(*ring))))
+		return NULL;
+
+	ring->used = 1;
+	ring->next = __atomic_load_n(&trace_rings_, __ATOMIC_ACQUIRE);
+	while (!__atomic_compare_exchange_n(&trace_rings_, &ring->next, ring,
+	 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+		;
+out:
+	pthread_setspecific(trace_ring_key_, ring);
+	trace_ring_ = ring;
+	return ring;
+}
+
+/* single producer: ring owner thread; markers are dropped when ring is full,
+ * like ftrace itself does, and counted in trace_dropped_
+ */
+static inline int trace_ring_push(const char *str, size_t len)
+{
+	struct trace_ring *ring = trace_ring_get();
+	if (!ring)
+		return trace_write_str(str, len);
+
+	uint32_t head = ring->head;
+	uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+	if (head - tail >= TRACE_RING_SIZE) {
+		__atomic_add_fetch(&trace_dropped_, 1, __ATOMIC_RELAXED);
+		return -1;
+	}
+
+	uint32_t i = head & (TRACE_RING_SIZE - 1);
+	memcpy(ring->buf[i], str, len);
+	ring->len[i] = len;
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/* single consumer: helper thread */
+static inline uint32_t trace_ring_drain(void)
+{
+	struct trace_ring *ring = __atomic_load_n(&trace_rings_,
+	 __ATOMIC_ACQUIRE);
+	uint32_t count = 0;
+
+	for (; ring; ring = ring->next) {
+		uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		uint32_t tail = ring->tail;
+
+		for (; tail != head; ++tail, ++count) {
+			uint32_t i = tail & (TRACE_RING_SIZE - 1);
+			trace_write_str(ring->buf[i], ring->len[i]);
+		}
+
+		__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+	}
+
+	return count;
+}
+
+static inline void *trace_ring_loop(void *arg)
+{
+	struct timespec ts = { 0, 1000000 }; /* 1 ms */
+
+	(void) arg;
+	while (!__atomic_load_n(&trace_ring_stop_, __ATOMIC_ACQUIRE)) {
+		if (!trace_ring_drain())
+			nanosleep(&ts, NULL);
+	}
+
+	trace_ring_drain();
+	return NULL;
+}
+
+/* key outlives stop/start cycles, rings of live threads stay attached */
+static inline void trace_ring_key_init(void)
+{
+	trace_ring_key_err_ = pthread_key_create(&trace_ring_key_,
+	 trace_ring_free);
+}
+
+static inline int trace_ring_start(void)
+{
+	if (trace_ring_on_)
+		return 0;
+	else if (trace_open(NULL) < 0)
+		return -1;
+
+	pthread_once(&trace_ring_once_, trace_ring_key_init);
+	if (trace_ring_key_err_ != 0)
+		return -1;
+
+	trace_ring_stop_ = 0;
+	if (pthread_create(&trace_ring_thread_, NULL, trace_ring_loop,
+	 NULL) != 0)
+		return -1;
+
+	__atomic_store_n(&trace_ring_on_, 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/* flushes pending markers; returns number of markers dropped so far
+ *
+ * Producers which saw ring mode on finish their pushes before the helper
+ * thread does its final drain, later ones write through.
+ */
+static inline uint64_t trace_ring_stop(void)
+{
+	struct timespec ts = { 0, 10000 }; /* 10 us */
+
+	if (!trace_ring_on_)
+		return trace_dropped_;
+
+	__atomic_store_n(&trace_ring_on_, 0, __ATOMIC_SEQ_CST);
+	while (__atomic_load_n(&trace_ring_users_, __ATOMIC_SEQ_CST))
+		nanosleep(&ts, NULL);
+
+	__atomic_store_n(&trace_ring_stop_, 1, __ATOMIC_RELEASE);
+	pthread_join(trace_ring_thread_, NULL);
+	return __atomic_load_n(&trace_dropped_, __ATOMIC_RELAXED);
+}
+
+static inline int trace_vwrite(const char *fmt, va_list args)
+{
+	char buf[TRACE_BUF_SIZE];
+	int len = vsnprintf(buf, sizeof(buf) - 1, fmt, args);
+
+	if (len < 0)
+		return -1;
+	else if ((size_t) len > sizeof(buf) - 2)
+		len = sizeof(buf) - 2; /* truncated */
+
+	if (len == 0 || buf[len - 1] != '\n')
+		buf[len++] = '\n';
+
+	if (__atomic_load_n(&trace_ring_on_, __ATOMIC_ACQUIRE)) {
+		/* pairs with trace_ring_stop(): either it waits for this push
+		 * or this sees ring mode off
+		 */
+		__atomic_add_fetch(&trace_ring_users_, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&trace_ring_on_, __ATOMIC_SEQ_CST)) {
+			int ret = trace_ring_push(buf, len);
+			__atomic_sub_fetch(&trace_ring_users_, 1,
+			 __ATOMIC_RELEASE);
+			return ret;
+		}
+
+		__atomic_sub_fetch(&trace_ring_users_, 1, __ATOMIC_RELEASE);
+	}
+
+	return trace_write_str(buf, len);
+}
+
+__attribute__((format(printf, 1, 2)))
+static inline int trace_write(const char *fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	int ret = trace_vwrite(fmt, args);
+	va_end(args);
+	return ret;
+}
+
+#define trace_marker(...) trace_write(__VA_ARGS__)
+#define trace_marker_mon(...) trace_write("mon," __VA_ARGS__)
+
 #endif /* TRACE_H_ */
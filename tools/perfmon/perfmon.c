@@ -4,6 +4,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <ctype.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/timerfd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
 #include <trace/trace.h>
 
 #define ee(...){\
@@ -15,8 +23,42 @@
 
 #define ii(...) printf("(ii) " __VA_ARGS__)
 
-static char label_[32];
+#define MAX_SOURCES 64
+#define MIN_READ 4096 /* initial buffer of keyed files */
+#define MAX_VALUES 8
+
+enum rule {
+	RULE_INT, /* first number in the file */
+	RULE_KEY, /* n-th number on the line starting with given key */
+	RULE_PERF, /* group of perf_event counters */
+};
+
+struct source {
+	char *path;
+	char label[32];
+	char key[32];
+	uint8_t col;
+	uint8_t rule;
+	uint8_t delta; /* report difference with previous sample */
+	uint8_t fixed; /* period is set by config */
+	uint8_t failed;
+	int fd;
+	uint32_t period; /* microseconds */
+	uint64_t deadline; /* nanoseconds */
+	uint8_t count; /* number of values, perf group has one per event */
+	const char *names[MAX_VALUES];
+	uint64_t raw[MAX_VALUES];
+	uint64_t value[MAX_VALUES];
+	int *perf_fds; /* group leader of every cpu comes first in its row */
+	uint16_t perf_groups;
+	char *buf; /* whole keyed file, grows to fit and is reused */
+	size_t buf_size;
+};
+
+static struct source sources_[MAX_SOURCES];
+static uint8_t source_count_;
 static uint32_t period_ = 5000; /* microseconds */
+static uint64_t missed_;
 
 #define GPU_PERF_ENABLE "/sys/kernel/debug/gpu.0/perfmon_events_enable"
 
@@ -38,151 +80,610 @@ static uint8_t enable_perf_events(char flag)
 }
 
 #define GPU_PERF "/sys/kernel/debug/gpu.0/perfmon_events_count"
+#define GPU_STATUS "/sys/kernel/debug/gpu.0/status"
 
-static void gpuperf_mon(void)
+static void gpustat_mon(void)
 {
-	if (!enable_perf_events(1))
+	FILE *f = fopen(GPU_STATUS, "r");
+	if (!f) {
+		ee("failed to open '" GPU_STATUS "' file");
 		return;
+	}
 
-	while (1) {
-		FILE *f = fopen(GPU_PERF, "r");
-		if (!f) {
-			ee("failed to open '" GPU_PERF "' file");
-			break;
+	fclose(f);
+}
+
+#define GPU_LOAD "/sys/devices/gpu.0/load"
+#define GPU_FREQ "/sys/kernel/debug/bpmp/debug/clk/gpcclk/rate"
+#define EMC_FREQ "/sys/kernel/debug/bpmp/debug/clk/emc/rate"
+#define EMC_LOAD "/sys/kernel/actmon_avg_activity/mc_all"
+
+/* monitors selected by symlink name */
+static const struct preset {
+	const char *name;
+	const char *path;
+	const char *help;
+} presets_[] = {
+	{ "gpuperf-mon", GPU_PERF, "GPU performance monitoring counter" },
+	{ "gpuload-mon", GPU_LOAD, "GPU load counter" },
+	{ "gpufreq-mon", GPU_FREQ, "GPU frequency" },
+	{ "emcload-mon", EMC_LOAD,
+	 "EMC load counter (external memory controller)" },
+	{ "emcfreq-mon", EMC_FREQ, "EMC frequency" },
+	{ NULL, NULL, NULL },
+};
+
+static const struct perf_event_desc {
+	const char *name;
+	uint32_t type;
+	uint64_t config;
+} perf_events_[] = {
+	/* software events, no PMU access needed */
+	{ "context-switches", PERF_TYPE_SOFTWARE,
+	 PERF_COUNT_SW_CONTEXT_SWITCHES },
+	{ "cpu-migrations", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS },
+	{ "page-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+	{ "task-clock", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+	{ "cpu-clock", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_CLOCK },
+	/* hardware events */
+	{ "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	{ "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	{ "cache-references", PERF_TYPE_HARDWARE,
+	 PERF_COUNT_HW_CACHE_REFERENCES },
+	{ "cache-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+	{ "branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+	{ NULL, 0, 0 },
+};
+
+static inline uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* all sources are kept open and sampled on shared ticks, values go out as
+ * one combined marker: mon,<value>,<label>[,<value>,<label>...]
+ */
+static struct source *add_source(const char *path)
+{
+	struct source *src;
+
+	if (source_count_ >= MAX_SOURCES) {
+		ee("too many sources, max %u\n", MAX_SOURCES);
+		return NULL;
+	}
+
+	src = &sources_[source_count_];
+	memset(src, 0, sizeof(*src));
+
+	if ((src->fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+		ee("failed to open '%s' file\n", path);
+		return NULL;
+	} else if (!(src->path = strdup(path))) {
+		ee("failed to copy '%s'\n", path);
+		close(src->fd);
+		return NULL;
+	}
+
+	src->rule = RULE_INT;
+	src->period = period_;
+	src->count = 1;
+	source_count_++;
+	return src;
+}
+
+static int open_perf_event(const struct perf_event_desc *desc, int pid,
+ int cpu, int group_fd)
+{
+	struct perf_event_attr attr;
+	int fd;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = desc->type;
+	attr.config = desc->config;
+	attr.read_format = PERF_FORMAT_GROUP;
+	attr.disabled = (group_fd < 0);
+	attr.inherit = (pid > 0);
+
+	fd = syscall(SYS_perf_event_open, &attr, pid, cpu, group_fd,
+	 PERF_FLAG_FD_CLOEXEC);
+	if (fd < 0 && (errno == EACCES || errno == EPERM)) {
+		/* perf_event_paranoid allows user space only */
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		fd = syscall(SYS_perf_event_open, &attr, pid, cpu, group_fd,
+		 PERF_FLAG_FD_CLOEXEC);
+	}
+
+	return fd;
+}
+
+/* target is 'pid:<pid>' to count task on any cpu, 'cpu:<n>' to count all
+ * tasks on one cpu or 'cpu:all' to sum all cpus; events are comma separated
+ * names from perf_events_
+ */
+static struct source *add_perf_source(const char *target, char *events)
+{
+	struct source *src;
+	int pid = -1;
+	int cpu = -1;
+	long cpus = 1;
+	char *save;
+
+	if (source_count_ >= MAX_SOURCES) {
+		ee("too many sources, max %u\n", MAX_SOURCES);
+		return NULL;
+	} else if (strncmp(target, "pid:", 4) == 0) {
+		pid = atoi(target + 4);
+	} else if (strcmp(target, "cpu:all") == 0) {
+		cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		cpu = 0; /* counted per cpu from 0 to cpus - 1 */
+	} else if (strncmp(target, "cpu:", 4) == 0) {
+		cpu = atoi(target + 4);
+	} else {
+		ee("bad perf target '%s'\n", target);
+		return NULL;
+	}
+
+	src = &sources_[source_count_];
+	memset(src, 0, sizeof(*src));
+
+	for (char *ptr = strtok_r(events, ",", &save); ptr;
+	 ptr = strtok_r(NULL, ",", &save)) {
+		const struct perf_event_desc *desc = perf_events_;
+
+		while (desc->name && strcmp(desc->name, ptr) != 0)
+			desc++;
+
+		if (!desc->name) {
+			ee("unknown perf event '%s'\n", ptr);
+			return NULL;
+		} else if (src->count >= MAX_VALUES) {
+			ee("too many perf events, max %u\n", MAX_VALUES);
+			return NULL;
 		}
 
-		size_t counter;
-		if (fscanf(f, "%zu", &counter) == EOF && errno) {
-			ee("'" GPU_PERF "' file reading error\n");
-			sleep(1);
+		src->names[src->count++] = desc->name;
+	}
+
+	if (!src->count || !(src->path = strdup(target))) {
+		return NULL;
+	} else if (!(src->perf_fds = malloc(cpus * src->count * sizeof(int)))) {
+		ee("failed to allocate perf fds\n");
+		free(src->path);
+		return NULL;
+	}
+
+	src->perf_groups = cpus;
+	for (long n = 0; n < cpus * src->count; ++n)
+		src->perf_fds[n] = -1;
+
+	for (long c = 0; c < cpus; ++c) {
+		int *fds = &src->perf_fds[c * src->count];
+
+		for (uint8_t i = 0; i < src->count; ++i) {
+			const struct perf_event_desc *desc = perf_events_;
+			while (strcmp(desc->name, src->names[i]) != 0)
+				desc++;
+
+			fds[i] = open_perf_event(desc, pid, cpu + c, fds[0]);
+			if (fds[i] < 0) {
+				ee("failed to open perf event '%s' for '%s'\n",
+				 desc->name, target);
+				goto err;
+			}
 		}
 
-		fclose(f);
-		trace_marker_mon("%zu,%s", counter, label_);
-		usleep(period_);
+		ioctl(fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+		ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
 	}
 
-	enable_perf_events(0);
+	src->fd = -1;
+	src->rule = RULE_PERF;
+	src->delta = 1;
+	src->period = period_;
+	strncpy(src->label, "perf", sizeof(src->label) - 1);
+	source_count_++;
+	return src;
+err:
+	for (long n = 0; n < cpus * src->count; ++n) {
+		if (src->perf_fds[n] >= 0)
+			close(src->perf_fds[n]);
+	}
+	free(src->perf_fds);
+	free(src->path);
+	return NULL;
 }
 
-#define GPU_STATUS "/sys/kernel/debug/gpu.0/status"
+static void close_sources(void)
+{
+	for (uint8_t i = 0; i < source_count_; ++i) {
+		struct source *src = &sources_[i];
 
-static void gpustat_mon(void)
+		for (long n = 0; n < src->perf_groups * src->count; ++n)
+			close(src->perf_fds[n]);
+
+		if (src->fd >= 0)
+			close(src->fd);
+
+		free(src->perf_fds);
+		free(src->path);
+		free(src->buf);
+	}
+
+	source_count_ = 0;
+}
+
+static int parse_key(struct source *src, char *buf, uint64_t *val)
 {
-	FILE *f = fopen(GPU_STATUS, "r");
-	if (!f) {
-		ee("failed to open '" GPU_STATUS "' file");
-		return;
+	size_t len = strlen(src->key);
+	char *ptr = buf;
+
+	while (ptr && *ptr) {
+		if (strncmp(ptr, src->key, len) == 0 && isspace(ptr[len])) {
+			ptr += len;
+			for (uint8_t i = 0; i < src->col; ++i)
+				*val = strtoull(ptr, &ptr, 10);
+			return 1;
+		} else if ((ptr = strchr(ptr, '\n'))) {
+			ptr++;
+		}
 	}
 
-	fclose(f);
+	return 0;
 }
 
-#define GPU_LOAD "/sys/devices/gpu.0/load"
+/* whole group comes with one read() per cpu: { nr, values[nr] } */
+static ssize_t read_perf(struct source *src, uint64_t *vals)
+{
+	uint64_t buf[1 + MAX_VALUES];
+
+	memset(vals, 0, src->count * sizeof(*vals));
+	for (uint16_t c = 0; c < src->perf_groups; ++c) {
+		int fd = src->perf_fds[c * src->count];
+		ssize_t n = read(fd, buf, sizeof(buf));
+
+		if (n < (ssize_t) sizeof(uint64_t) || buf[0] != src->count)
+			return -1;
+
+		for (uint8_t i = 0; i < src->count; ++i)
+			vals[i] += buf[1 + i];
+	}
+
+	return 1;
+}
 
-static void gpuload_mon(void)
+/* keys may be far into the file, e.g. ctxt in /proc/stat comes after per-cpu
+ * and intr lines, so read until EOF
+ */
+static ssize_t read_file(struct source *src)
 {
-	while (1) {
-		FILE *f = fopen(GPU_LOAD, "r");
-		if (!f) {
-			ee("failed to open '" GPU_LOAD "' file");
-			return;
-		}
+	size_t n = 0;
+
+	for (;;) {
+		ssize_t ret;
 
-		size_t counter;
-		if (fscanf(f, "%zu", &counter) == EOF && errno) {
-			ee("'" GPU_LOAD "' file reading error\n");
-			sleep(1);
+		if (n + 1 >= src->buf_size) {
+			size_t size = src->buf_size ? src->buf_size * 2 : MIN_READ;
+			char *buf = realloc(src->buf, size);
+
+			if (!buf) {
+				ee("failed to allocate %zu bytes\n", size);
+				return -1;
+			}
+
+			src->buf = buf;
+			src->buf_size = size;
 		}
 
-		fclose(f);
-		trace_marker_mon("%zu,%s", counter, label_);
-		usleep(period_);
+		ret = pread(src->fd, src->buf + n, src->buf_size - 1 - n, n);
+		if (ret < 0)
+			return -1;
+		else if (ret == 0)
+			break;
+
+		n += ret;
 	}
-}
 
-#define GPU_FREQ "/sys/kernel/debug/bpmp/debug/clk/gpcclk/rate"
+	src->buf[n] = '\0';
+	return n;
+}
 
-static void gpufreq_mon(void)
+static void read_source(struct source *src)
 {
-	while (1) {
-		FILE *f = fopen(GPU_FREQ, "r");
-		if (!f) {
-			ee("failed to open '" GPU_FREQ "' file");
-			return;
+	char buf[32];
+	uint64_t vals[MAX_VALUES] = {0};
+	ssize_t n;
+
+	if (src->rule == RULE_PERF) {
+		n = read_perf(src, vals);
+	} else if (src->rule == RULE_INT) {
+		if ((n = pread(src->fd, buf, sizeof(buf) - 1, 0)) > 0) {
+			buf[n] = '\0';
+			vals[0] = strtoull(buf, NULL, 10);
 		}
+	} else if ((n = read_file(src)) > 0) {
+		if (!parse_key(src, src->buf, &vals[0]))
+			n = 0;
+	}
 
-		size_t counter;
-		if (fscanf(f, "%zu", &counter) == EOF && errno) {
-			ee("'" GPU_FREQ "' file reading error\n");
-			sleep(1);
-		}
-		fclose(f);
-		trace_marker_mon("%zu,%s", counter, label_);
-		usleep(period_);
+	if (n <= 0) {
+		if (!src->failed)
+			ee("'%s' reading error\n", src->path);
+		src->failed = 1;
+		return; /* keep previous value */
 	}
+
+	for (uint8_t i = 0; i < src->count; ++i) {
+		if (!src->delta)
+			src->value[i] = vals[i];
+		else if (src->raw[i])
+			src->value[i] = vals[i] - src->raw[i];
+
+		src->raw[i] = vals[i];
+	}
+
+	src->failed = 0;
 }
 
-#define EMC_FREQ "/sys/kernel/debug/bpmp/debug/clk/emc/rate"
+static int set_timer(int fd, uint64_t deadline, uint64_t interval)
+{
+	struct itimerspec its;
 
-static void emcfreq_mon(void)
+	its.it_value.tv_sec = deadline / 1000000000ULL;
+	its.it_value.tv_nsec = deadline % 1000000000ULL;
+	its.it_interval.tv_sec = interval / 1000000000ULL;
+	its.it_interval.tv_nsec = interval % 1000000000ULL;
+
+	if (timerfd_settime(fd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+		ee("failed to set timer\n");
+		return 0;
+	}
+
+	return 1;
+}
+
+/* samples sources which are due and moves their deadlines forward; sources
+ * share the same base time, so those with multiple periods are sampled on
+ * the same wakeup
+ */
+static uint64_t emit_sources(uint64_t now)
 {
-	while (1) {
-		FILE *f = fopen(EMC_FREQ, "r");
-		if (!f) {
-			ee("failed to open '" EMC_FREQ "' file");
-			return;
+	char marker[TRACE_BUF_SIZE];
+	uint64_t next = UINT64_MAX;
+	size_t len = 0;
+
+	for (uint8_t i = 0; i < source_count_; ++i) {
+		struct source *src = &sources_[i];
+
+		if (src->deadline <= now) {
+			uint64_t period = src->period * 1000ULL;
+
+			read_source(src);
+			src->deadline += period;
+			if (src->deadline <= now) {
+				uint64_t skip = (now - src->deadline) / period + 1;
+				src->deadline += skip * period;
+				missed_ += skip;
+			}
+		} else {
+			goto next;
 		}
 
-		size_t counter;
-		if (fscanf(f, "%zu", &counter) == EOF && errno) {
-			ee("'" EMC_FREQ "' file reading error\n");
-			sleep(1);
+		for (uint8_t v = 0; v < src->count; ++v) {
+			char item[80];
+			int n;
+
+			if (src->rule == RULE_PERF) {
+				n = snprintf(item, sizeof(item), ",%" PRIu64
+				 ",%s.%s", src->value[v], src->label,
+				 src->names[v]);
+			} else {
+				n = snprintf(item, sizeof(item), ",%" PRIu64
+				 ",%s", src->value[v], src->label);
+			}
+
+			/* split into several markers if it does not fit */
+			if (len && len + n + 1 >= sizeof(marker)) {
+				marker[len++] = '\n';
+				trace_write_str(marker, len);
+				len = 0;
+			}
+
+			if (!len)
+				len = snprintf(marker, sizeof(marker), "mon");
+
+			memcpy(marker + len, item, n);
+			len += n;
 		}
+next:
+		if (next > src->deadline)
+			next = src->deadline;
+	}
 
-		fclose(f);
-		trace_marker_mon("%zu,%s", counter, label_);
-		usleep(period_);
+	if (len) {
+		marker[len++] = '\n';
+		trace_write_str(marker, len);
 	}
-}
 
-#define EMC_LOAD "/sys/kernel/actmon_avg_activity/mc_all"
+	return next;
+}
 
-static void emcload_mon(void)
+static void sample_sources(void)
 {
+	uint64_t now = now_ns();
+	uint64_t interval;
+	uint64_t ticks;
+	uint64_t next;
+	int fd;
+
+	if ((fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC)) < 0) {
+		ee("failed to create timer\n");
+		return;
+	}
+
+	/* absolute deadlines are advanced by period from previous deadline,
+	 * not from the moment we woke up, so sampling does not drift; one-shot
+	 * timer is armed at the nearest deadline only, so we never wake up
+	 * without work to do; when all periods are equal the timer is periodic
+	 * and is never re-armed
+	 */
+	next = UINT64_MAX;
+	interval = sources_[0].period * 1000ULL;
+	for (uint8_t i = 0; i < source_count_; ++i) {
+		sources_[i].deadline = now + sources_[i].period * 1000ULL;
+		if (next > sources_[i].deadline)
+			next = sources_[i].deadline;
+		if (interval != sources_[i].period * 1000ULL)
+			interval = 0;
+	}
+
+	if (!set_timer(fd, next, interval)) {
+		close(fd);
+		return;
+	}
+
 	while (1) {
-		FILE *f = fopen(EMC_LOAD, "r");
-		if (!f) {
-			ee("failed to open '" EMC_LOAD "' file");
-			return;
-		}
+		if (read(fd, &ticks, sizeof(ticks)) != sizeof(ticks)) {
+			if (errno == EINTR)
+				continue;
 
-		size_t counter;
-		if (fscanf(f, "%zu", &counter) == EOF && errno) {
-			ee("'" EMC_LOAD "' file reading error\n");
-			sleep(1);
+			ee("failed to read timer\n");
+			break;
 		}
 
-		fclose(f);
-		trace_marker_mon("%zu,%s", counter, label_);
-		usleep(period_);
+		uint64_t missed = missed_;
+		next = emit_sources(now_ns());
+		if (missed_ / 100 != missed / 100)
+			ii("missed %" PRIu64 " samples so far\n", missed_);
+
+		if (!interval && !set_timer(fd, next, 0))
+			break;
 	}
+
+	close(fd);
+}
+
+/* config line: <label> <period-us> <path> <rule> [args] [delta]
+ *
+ * rules:
+ *  int              first number in the file
+ *  key <key> [col]  col-th number (1 by default) on the line starting with
+ *                   key, e.g. 'key MemFree:' for /proc/meminfo or 'key cpu 4'
+ *                   for idle time in /proc/stat
+ *  perf <events>    comma separated perf events read as one group, path is
+ *                   'pid:<pid>', 'cpu:<n>' or 'cpu:all', always delta
+ * 'delta' reports difference between consecutive samples of the counter
+ */
+static int parse_config_line(char *line, uint32_t nr)
+{
+	char *tok[8];
+	uint8_t n = 0;
+	char *save;
+	struct source *src;
+
+	for (char *ptr = strtok_r(line, " \t\r\n", &save); ptr && n < 8;
+	 ptr = strtok_r(NULL, " \t\r\n", &save)) {
+		if (*ptr == '#')
+			break;
+		tok[n++] = ptr;
+	}
+
+	if (n == 0) {
+		return 1;
+	} else if (n < 4) {
+		ee("line %u: expected '<label> <period-us> <path> <rule>'\n", nr);
+		return 0;
+	} else if (strcmp(tok[3], "perf") == 0) {
+		if (n != 5 || !(src = add_perf_source(tok[2], tok[4])))
+			return 0;
+		n = 0; /* no other rule args */
+	} else if (!(src = add_source(tok[2]))) {
+		return 0;
+	}
+
+	strncpy(src->label, tok[0], sizeof(src->label) - 1);
+	if ((src->period = atoi(tok[1])))
+		src->fixed = 1;
+	else
+		src->period = period_;
+
+	if (n && strcmp(tok[n - 1], "delta") == 0) {
+		src->delta = 1;
+		n--;
+	}
+
+	if (src->rule == RULE_PERF) {
+		/* already set up */
+	} else if (strcmp(tok[3], "int") == 0 && n == 4) {
+		src->rule = RULE_INT;
+	} else if (strcmp(tok[3], "key") == 0 && (n == 5 || n == 6)) {
+		src->rule = RULE_KEY;
+		strncpy(src->key, tok[4], sizeof(src->key) - 1);
+		src->col = (n == 6) ? atoi(tok[5]) : 1;
+	} else {
+		ee("line %u: bad rule '%s'\n", nr, tok[3]);
+		return 0;
+	}
+
+	ii("Using '%s' every %u us for '%s'\n", src->path, src->period,
+	 src->label);
+	return 1;
+}
+
+static int load_config(const char *path)
+{
+	FILE *f = fopen(path, "r");
+	char line[512];
+	uint32_t nr = 0;
+	int ret = 1;
+
+	if (!f) {
+		ee("failed to open '%s' file\n", path);
+		return 0;
+	}
+
+	while (ret && fgets(line, sizeof(line), f))
+		ret = parse_config_line(line, ++nr);
+
+	fclose(f);
+	return ret;
 }
 
 static void help(const char *name)
 {
 	printf("Usage: create and run symlink with desired function\n"
 	 "Available monitors:\n"
-         "\033[2m"
-	 " gpuperf-mon  for GPU performance monitoring counter\n"
-	 " gpuload-mon  for GPU load counter\n"
-	 " gpufreq-mon  for GPU frequency\n"
-	 " emcload-mon  for EMC load counter (external memory controller)\n"
-	 " emcfreq-mon  for EMC frequency\n"
+         "\033[2m");
+
+	for (const struct preset *p = presets_; p->name; ++p)
+		printf(" %s  for %s\n", p->name, p->help);
+
+	printf("\033[0m"
+	 "Options:\n"
+	 "\033[2m"
+	 " --source <path>   sample another file, can be repeated\n"
+	 " --label <label>   label of the last source\n"
+	 " --period-us <n>   default sampling period in microseconds\n"
+	 " --config <file>   read sources from file, see perfmon.conf\n"
+	 " --perf <events>[@<target>]\n"
+	 "                   perf counters, target is pid:<pid>, cpu:<n> or\n"
+	 "                   cpu:all (default)\n"
 	 "\033[0m"
 	 "Example:\n"
 	 " ~/> ln -sf %s gpuperf-mon\n"
-	 " ~/> ./gpuperf-mon --label MHz\n", name);
+	 " ~/> ./gpuperf-mon --label MHz\n"
+	 " ~/> %s --source /tmp/a --label a --source /tmp/b --label b\n"
+	 " ~/> %s --config perfmon.conf\n"
+	 " ~/> %s --perf context-switches,task-clock@pid:1234\n",
+	 name, name, name, name);
+
+	printf("Perf events:\n\033[2m");
+	for (const struct perf_event_desc *p = perf_events_; p->name; ++p)
+		printf(" %s\n", p->name);
+	printf("\033[0m");
 }
 
 static int opt(const char *arg, const char *argl)
@@ -190,52 +691,93 @@ static int opt(const char *arg, const char *argl)
 	return (strcmp(arg, argl) == 0);
 }
 
-static void getopts(int argc, const char *argv[])
+static int getopts(int argc, const char *argv[])
 {
 	const char *arg;
+	struct source *src = source_count_ ? &sources_[0] : NULL;
 
-	for (uint8_t i = 0; i < argc; ++i) {
+	for (int i = 0; i < argc; ++i) {
 		arg = argv[i];
-		if (opt(arg, "--label")) {
+		if (i + 1 >= argc) {
+			break;
+		} else if (opt(arg, "--label")) {
 			i++;
-			strncpy(label_, argv[i], sizeof(label_) - 1);
-			ii("Using label '%s'\n", label_);
+			if (!src) {
+				ee("--label without source\n");
+				return 0;
+			}
+			strncpy(src->label, argv[i], sizeof(src->label) - 1);
+			ii("Using label '%s' for '%s'\n", src->label, src->path);
 		} else if (opt(arg, "--period-us")) {
 			i++;
-			period_ = atoi(argv[i]);
+			if (!(period_ = atoi(argv[i]))) {
+				ee("invalid period\n");
+				return 0;
+			}
 			ii("Using period %d us\n", period_);
+			for (uint8_t n = 0; n < source_count_; ++n) {
+				if (!sources_[n].fixed)
+					sources_[n].period = period_;
+			}
+		} else if (opt(arg, "--source")) {
+			i++;
+			if (!(src = add_source(argv[i])))
+				return 0;
+		} else if (opt(arg, "--perf")) {
+			char events[256];
+			char *target;
+
+			strncpy(events, argv[++i], sizeof(events) - 1);
+			events[sizeof(events) - 1] = '\0';
+
+			if ((target = strchr(events, '@')))
+				*target++ = '\0';
+
+			if (!(src = add_perf_source(target ? target : "cpu:all",
+			 events)))
+				return 0;
+		} else if (opt(arg, "--config")) {
+			i++;
+			if (!load_config(argv[i]))
+				return 0;
+			src = NULL;
 		}
 	}
-}
 
-typedef void (*monitor_fn)(void);
+	return 1;
+}
 
 int main(int argc, const char *argv[])
 {
-	monitor_fn fn = NULL;
-
-	if (strstr(argv[0], "gpuperf-mon")) {
-		fn = gpuperf_mon;
-	} else if (strstr(argv[0], "gpuload-mon")) {
-		fn = gpuload_mon;
-	} else if (strstr(argv[0], "gpufreq-mon")) {
-		fn = gpufreq_mon;
-	} else if (strstr(argv[0], "emcload-mon")) {
-		fn = emcload_mon;
-	} else if (strstr(argv[0], "emcfreq-mon")) {
-		fn = emcfreq_mon;
-	} else {
+	const struct preset *preset;
+	uint8_t gpuperf;
+
+	for (preset = presets_; preset->name; ++preset) {
+		if (strstr(argv[0], preset->name))
+			break;
+	}
+
+	gpuperf = preset->name && strcmp(preset->name, "gpuperf-mon") == 0;
+
+	if (preset->path && !add_source(preset->path)) {
+		return 1;
+	} else if (!getopts(argc, argv)) {
+		return 1;
+	} else if (!source_count_) {
 		help(argv[0]);
 		return 0;
+	} else if (gpuperf && !enable_perf_events(1)) {
+		return 1;
 	}
 
-	getopts(argc, argv);
-
 	pid_t pid;
 	if ((pid = fork()) < 0) {
 		return 1;
 	} else if (pid == 0) {  // child process
-		fn();
+		sample_sources();
+		close_sources();
+		if (gpuperf)
+			enable_perf_events(0);
 	}
 
 	return 0;
@@ -0,0 +1,678 @@
+#include <stdio.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define ee(...){\
+	int errno__ = errno;\
+	fprintf(stderr, "(ee) " __VA_ARGS__);\
+	fprintf(stderr, "(ee) %s | %s:%d\n", strerror(errno__), __func__,\
+	 __LINE__);\
+	errno = errno__;\
+}
+
+#define ii(...) fprintf(stderr, "(ii) " __VA_ARGS__)
+
+#define MON_PID 900
+#define GPU_PID 901
+#define TASK_PID 1000
+#define MAX_CPUS 1024
+
+struct task {
+	char comm[16];
+	uint32_t pid;
+	uint16_t cpu; /* last cpu task ran on */
+	uint64_t pcount;
+	uint8_t running;
+	uint8_t sleeping; /* switched out in 'S' state */
+};
+
+struct cpu {
+	struct task *curr; /* NULL means idle */
+	double next_ts;
+};
+
+/* periodic and random events besides scheduler ones */
+enum stream {
+	STREAM_MON,
+	STREAM_GPU,
+	STREAM_PRESENT,
+	STREAM_IRQ,
+	STREAM_FREQ,
+	STREAMS,
+};
+
+static uint32_t tasks_ = 16;
+static uint16_t cpus_ = 4;
+static double duration_ = 10; /* seconds */
+static double rate_ = 100000; /* scheduler events per second */
+static uint64_t events_; /* overrides duration when set */
+static uint32_t mon_period_ = 5000; /* microseconds, 0 disables */
+static uint32_t gpu_period_ = 16667; /* microseconds, 0 disables */
+static uint32_t present_period_ = 16667; /* microseconds, 0 disables */
+static double irq_rate_ = 2000; /* interrupts per second, 0 disables */
+static uint32_t freq_period_ = 10000; /* microseconds, 0 disables power */
+static uint8_t migrate_events_ = 1;
+static uint32_t marker_ratio_ = 50; /* one marker per N switches */
+static uint64_t seed_ = 1;
+static uint64_t state_;
+static uint8_t task_stat_;
+static uint8_t sched_switch_ = 1;
+static const char *output_;
+
+static struct task *task_list_;
+static struct cpu cpu_list_[MAX_CPUS];
+static double base_ts_ = 1000;
+static uint64_t written_;
+
+/* xorshift64*, good enough and identical on every host */
+static uint64_t rnd(void)
+{
+	state_ ^= state_ >> 12;
+	state_ ^= state_ << 25;
+	state_ ^= state_ >> 27;
+	return state_ * 2685821657736338717ULL;
+}
+
+static double rnd_unit(void)
+{
+	return (rnd() >> 11) * (1. / 9007199254740992.);
+}
+
+/* exponentially distributed interval with given mean */
+static double rnd_exp(double mean)
+{
+	return -log(1. - rnd_unit()) * mean;
+}
+
+static void print_header(FILE *f)
+{
+	fprintf(f, "# tracer: nop\n"
+	 "#\n"
+	 "# generated by tracegen: tasks %u cpus %u rate %.0f seed %llu\n"
+	 "#\n"
+	 "#           TASK-PID     CPU#  |||||  TIMESTAMP  FUNCTION\n"
+	 "#              | |         |   |||||     |         |\n",
+	 tasks_, cpus_, rate_, (unsigned long long) seed_);
+}
+
+static void print_prefix(FILE *f, const char *comm, uint32_t pid,
+ uint16_t cpu, double ts)
+{
+	char task[32];
+	snprintf(task, sizeof(task), "%s-%u", comm, pid);
+	fprintf(f, "%24s [%03u] d..2. %12.6f: ", task, cpu, ts);
+}
+
+static void print_task_stat(FILE *f, struct task *t, uint16_t cpu, double ts,
+ uint8_t on)
+{
+	print_prefix(f, t->comm, t->pid, cpu, ts);
+	fprintf(f, "sched_task_stat: %llu %u %u %u %llu %s\n",
+	 (unsigned long long) (ts * 1e9), t->pid, on, cpu,
+	 (unsigned long long) t->pcount, t->comm);
+	written_++;
+}
+
+static void print_switch(FILE *f, struct task *prev, struct task *next,
+ uint16_t cpu, double ts)
+{
+	char idle[16];
+	snprintf(idle, sizeof(idle), "swapper/%u", cpu);
+
+	if (task_stat_) {
+		if (prev)
+			print_task_stat(f, prev, cpu, ts, 0);
+		if (next)
+			print_task_stat(f, next, cpu, ts, 1);
+	}
+
+	if (!sched_switch_)
+		return;
+
+	char state = 'R';
+	if (prev) {
+		state = (rnd() & 3) ? 'S' : 'R';
+		prev->sleeping = state == 'S';
+		print_prefix(f, prev->comm, prev->pid, cpu, ts);
+	} else {
+		print_prefix(f, "<idle>", 0, cpu, ts);
+	}
+
+	fprintf(f, "sched_switch: prev_comm=%s prev_pid=%u prev_prio=120 "
+	 "prev_state=%c ==> next_comm=%s next_pid=%u next_prio=120\n",
+	 prev ? prev->comm : idle, prev ? prev->pid : 0, state,
+	 next ? next->comm : idle, next ? next->pid : 0);
+	written_++;
+}
+
+/* sleeping task is woken up by whatever runs on some other cpu right now,
+ * idle cpu stands for an interrupt
+ */
+static void print_wakeup(FILE *f, struct task *t, uint16_t cpu, double ts)
+{
+	uint16_t waker_cpu = rnd() % cpus_;
+	struct task *waker = cpu_list_[waker_cpu].curr;
+
+	if (waker == t)
+		waker = NULL;
+
+	if (waker)
+		print_prefix(f, waker->comm, waker->pid, waker_cpu, ts);
+	else
+		print_prefix(f, "<idle>", 0, waker_cpu, ts);
+
+	fprintf(f, "sched_waking: comm=%s pid=%u prio=120 target_cpu=%03u\n",
+	 t->comm, t->pid, cpu);
+
+	if (waker)
+		print_prefix(f, waker->comm, waker->pid, waker_cpu, ts);
+	else
+		print_prefix(f, "<idle>", 0, waker_cpu, ts);
+
+	fprintf(f, "sched_wakeup: comm=%s pid=%u prio=120 target_cpu=%03u\n",
+	 t->comm, t->pid, cpu);
+
+	t->sleeping = 0;
+	written_ += 2;
+}
+
+static void print_marker(FILE *f, struct task *t, uint16_t cpu, double ts)
+{
+	print_prefix(f, t->comm, t->pid, cpu, ts);
+	fprintf(f, "tracing_mark_write: %s pcount %llu\n", t->comm,
+	 (unsigned long long) t->pcount);
+	written_++;
+}
+
+static void print_monitor(FILE *f, uint16_t cpu, double ts)
+{
+	static uint64_t load = 500;
+
+	load += rnd() % 101;
+	load -= 50;
+	if (load > 1000)
+		load = (load > 2000) ? 0 : 1000;
+
+	print_prefix(f, "gpuload-mon", MON_PID, cpu, ts);
+	fprintf(f, "tracing_mark_write: mon,%llu,load\n",
+	 (unsigned long long) load);
+	written_++;
+}
+
+/* job submitted on previous tick has run on GPU since then; submit marker
+ * carries the same id as the job like vkmon does, submitter also opens an
+ * atrace async slice which GPU monitor finishes with the same cookie
+ */
+static void print_gpu_job(FILE *f, uint16_t cpu, double ts)
+{
+	static int32_t job_id;
+	static struct task *submitter;
+	static double submit_ts;
+	double period = gpu_period_ / 1e6;
+
+	if (submitter) {
+		double start = submit_ts + rnd_exp(period / 10);
+		double runtime = rnd_exp(period / 2);
+
+		if (start > ts)
+			start = ts;
+		if (runtime > ts - start)
+			runtime = ts - start;
+
+		print_prefix(f, "gpu-mon", GPU_PID, cpu, ts);
+		fprintf(f, "tracing_mark_write: gpu,0,%d,%llu,%llu,%f,%u\n",
+		 job_id - 1, (unsigned long long) (start * 1e9),
+		 (unsigned long long) ((start + runtime) * 1e9),
+		 runtime * 1e3, submitter->pid);
+		print_prefix(f, "gpu-mon", GPU_PID, cpu, ts);
+		fprintf(f, "tracing_mark_write: F|%u|gpu_job|%d\n",
+		 submitter->pid, job_id - 1);
+		written_ += 2;
+	}
+
+	submitter = &task_list_[rnd() % tasks_];
+	submit_ts = ts;
+
+	print_prefix(f, submitter->comm, submitter->pid, cpu, ts);
+	fprintf(f, "tracing_mark_write: vkmon_vkQueueSubmit id %d queue 0x1 "
+	 "seq %d\n", job_id, job_id);
+	print_prefix(f, submitter->comm, submitter->pid, cpu, ts);
+	fprintf(f, "tracing_mark_write: S|%u|gpu_job|%d\n", submitter->pid,
+	 job_id);
+	job_id++;
+	written_ += 2;
+}
+
+/* first task presents; frames jitter a bit and one in 50 takes twice as
+ * long, so the viewer has some jank to show; every frame is a systrace
+ * style B|pid|frame span with nested plain B|record span, which ends
+ * somewhere in the middle of the frame, and C|pid|frame_us counter carries
+ * duration of the previous frame
+ */
+static double print_present(FILE *f, uint16_t cpu, double ts)
+{
+	static uint64_t frame;
+	static double next_ts;
+	static uint8_t recording;
+	static double frame_ts;
+	struct task *t = &task_list_[0];
+	double period = present_period_ / 1e6;
+
+	print_prefix(f, t->comm, t->pid, cpu, ts);
+
+	if (recording) {
+		fprintf(f, "tracing_mark_write: E|record\n");
+		recording = 0;
+		written_++;
+		return next_ts;
+	}
+
+	if (frame) {
+		fprintf(f, "tracing_mark_write: E|%u\n", t->pid);
+		print_prefix(f, t->comm, t->pid, cpu, ts);
+		fprintf(f, "tracing_mark_write: C|%u|frame_us|%.0f\n", t->pid,
+		 (ts - frame_ts) * 1e6);
+		print_prefix(f, t->comm, t->pid, cpu, ts);
+	}
+
+	fprintf(f, "tracing_mark_write: present,%llu,%llu\n",
+	 (unsigned long long) frame, (unsigned long long) frame);
+	print_prefix(f, t->comm, t->pid, cpu, ts);
+	fprintf(f, "tracing_mark_write: B|%u|frame\n", t->pid);
+	print_prefix(f, t->comm, t->pid, cpu, ts);
+	fprintf(f, "tracing_mark_write: B|record\n");
+	written_ += 3 + 2 * !!frame;
+	frame_ts = ts;
+	frame++;
+	recording = 1;
+
+	if (rnd() % 50 == 0)
+		period *= 2;
+
+	next_ts = ts + period * (.9 + .2 * rnd_unit());
+	return ts + (next_ts - ts) * (.3 + .4 * rnd_unit());
+}
+
+/* every interrupt is hardirq followed by softirq on the same cpu; entries
+ * and exits come one per call, so lines stay in time order
+ */
+static double print_irq(FILE *f, double ts)
+{
+	static const char *names[] = { "eth0", "nvme0q1", "i915", "timer" };
+	static const char *vecs[] = { "TIMER", "NET_RX", "BLOCK", "RCU" };
+	static const uint8_t vec_nrs[] = { 1, 3, 4, 9 }; /* as in kernel */
+	static uint8_t phase;
+	static uint16_t cpu;
+	static uint16_t irq;
+	struct task *t;
+
+	if (phase == 0) {
+		cpu = rnd() % cpus_;
+		irq = rnd() % (sizeof(names) / sizeof(*names));
+	}
+
+	if ((t = cpu_list_[cpu].curr))
+		print_prefix(f, t->comm, t->pid, cpu, ts);
+	else
+		print_prefix(f, "<idle>", 0, cpu, ts);
+
+	written_++;
+
+	switch (phase++) {
+	case 0:
+		fprintf(f, "irq_handler_entry: irq=%u name=%s\n", irq + 24,
+		 names[irq]);
+		return ts + rnd_exp(5e-6);
+	case 1:
+		fprintf(f, "irq_handler_exit: irq=%u ret=handled\n", irq + 24);
+		return ts;
+	case 2:
+		fprintf(f, "softirq_entry: vec=%u [action=%s]\n", vec_nrs[irq],
+		 vecs[irq]);
+		return ts + rnd_exp(20e-6);
+	default:
+		fprintf(f, "softirq_exit: vec=%u [action=%s]\n", vec_nrs[irq],
+		 vecs[irq]);
+		phase = 0;
+		return ts + rnd_exp(1 / irq_rate_);
+	}
+}
+
+static void print_migrate(FILE *f, struct task *t, uint16_t cpu, double ts)
+{
+	print_prefix(f, "<idle>", 0, cpu, ts);
+	fprintf(f, "sched_migrate_task: comm=%s pid=%u prio=120 orig_cpu=%u "
+	 "dest_cpu=%u\n", t->comm, t->pid, t->cpu, cpu);
+	written_++;
+}
+
+/* random cpu changes its frequency */
+static void print_frequency(FILE *f, double ts)
+{
+	static const uint32_t khz[] = { 800000, 1400000, 2200000, 3000000 };
+	uint16_t cpu = rnd() % cpus_;
+	struct task *t = cpu_list_[cpu].curr;
+
+	if (t)
+		print_prefix(f, t->comm, t->pid, cpu, ts);
+	else
+		print_prefix(f, "<idle>", 0, cpu, ts);
+
+	fprintf(f, "cpu_frequency: state=%u cpu_id=%u\n",
+	 khz[rnd() % (sizeof(khz) / sizeof(*khz))], cpu);
+	written_++;
+}
+
+/* idle cpu enters shallow or deep state, exit is (u32) -1 */
+static void print_idle(FILE *f, uint16_t cpu, double ts, uint32_t state)
+{
+	print_prefix(f, "<idle>", 0, cpu, ts);
+	fprintf(f, "cpu_idle: state=%u cpu_id=%u\n", state, cpu);
+	written_++;
+}
+
+/* pick random runnable task which is not on any cpu right now */
+static struct task *pick_next(void)
+{
+	uint32_t first = rnd() % tasks_;
+
+	for (uint32_t i = 0; i < tasks_; ++i) {
+		struct task *t = &task_list_[(first + i) % tasks_];
+		if (!t->running)
+			return t;
+	}
+
+	return NULL;
+}
+
+static uint16_t next_cpu(void)
+{
+	uint16_t cpu = 0;
+
+	for (uint16_t i = 1; i < cpus_; ++i) {
+		if (cpu_list_[i].next_ts < cpu_list_[cpu].next_ts)
+			cpu = i;
+	}
+
+	return cpu;
+}
+
+/* returns stream with the earliest event not later than ts or -1, ties
+ * go in stream order
+ */
+static int next_stream(const double *stream_ts, double ts)
+{
+	int s = -1;
+
+	for (int i = 0; i < STREAMS; ++i) {
+		if (stream_ts[i] > ts)
+			continue;
+		else if (s < 0 || stream_ts[i] < stream_ts[s])
+			s = i;
+	}
+
+	return s;
+}
+
+/* events of all streams due before a switch are merged by timestamp, so
+ * lines come in time order like in a real trace
+ */
+static void print_streams(FILE *f, double *stream_ts, uint16_t cpu,
+ double ts)
+{
+	int s;
+
+	while ((s = next_stream(stream_ts, ts)) >= 0) {
+		double *next_ts = &stream_ts[s];
+
+		switch (s) {
+		case STREAM_MON:
+			print_monitor(f, cpu, *next_ts);
+			*next_ts += mon_period_ / 1e6;
+			break;
+		case STREAM_GPU:
+			print_gpu_job(f, cpu, *next_ts);
+			*next_ts += gpu_period_ / 1e6;
+			break;
+		case STREAM_PRESENT:
+			*next_ts = print_present(f, cpu, *next_ts);
+			break;
+		case STREAM_IRQ:
+			*next_ts = print_irq(f, *next_ts);
+			break;
+		default:
+			print_frequency(f, *next_ts);
+			*next_ts += freq_period_ / 1e6;
+			break;
+		}
+	}
+}
+
+static void generate(FILE *f)
+{
+	double slice = cpus_ / rate_; /* mean slice length per cpu */
+	double end_ts = base_ts_ + duration_;
+	double stream_ts[STREAMS]; /* next event, infinity if disabled */
+	uint64_t switches = 0;
+
+	stream_ts[STREAM_MON] = mon_period_ ? base_ts_ : INFINITY;
+	stream_ts[STREAM_GPU] = gpu_period_ ? base_ts_ : INFINITY;
+	stream_ts[STREAM_PRESENT] = present_period_ ? base_ts_ : INFINITY;
+	stream_ts[STREAM_IRQ] = irq_rate_ > 0 ? base_ts_ : INFINITY;
+	stream_ts[STREAM_FREQ] = freq_period_ ? base_ts_ : INFINITY;
+
+	state_ = seed_;
+	for (uint16_t i = 0; i < cpus_; ++i)
+		cpu_list_[i].next_ts = base_ts_ + rnd_exp(slice);
+
+	print_header(f);
+
+	while (1) {
+		uint16_t cpu = next_cpu();
+		struct cpu *c = &cpu_list_[cpu];
+		double ts = c->next_ts;
+
+		if (events_ && written_ >= events_)
+			break;
+		else if (!events_ && ts >= end_ts)
+			break;
+
+		print_streams(f, stream_ts, cpu, ts);
+
+		struct task *prev = c->curr;
+		struct task *next;
+
+		/* leave cpu idle now and then like real systems do */
+		if (prev && rnd() % 8 == 0) {
+			next = NULL;
+		} else {
+			if (prev)
+				prev->running = 0;
+			next = pick_next();
+			if (prev)
+				prev->running = 1;
+		}
+
+		if (next == prev) {
+			c->next_ts = ts + rnd_exp(slice);
+			continue;
+		}
+
+		if (prev)
+			prev->running = 0;
+
+		if (next && next->sleeping && sched_switch_)
+			print_wakeup(f, next, cpu, ts);
+
+		if (next && next->pcount && next->cpu != cpu && migrate_events_)
+			print_migrate(f, next, cpu, ts);
+
+		if (next) {
+			next->running = 1;
+			next->cpu = cpu;
+			next->pcount++;
+		}
+
+		if (freq_period_ && !prev)
+			print_idle(f, cpu, ts, UINT32_MAX);
+
+		print_switch(f, prev, next, cpu, ts);
+		c->curr = next;
+
+		if (freq_period_ && !next)
+			print_idle(f, cpu, ts, rnd() & 1);
+
+		c->next_ts = ts + rnd_exp(slice);
+		switches++;
+
+		if (next && marker_ratio_ && switches % marker_ratio_ == 0)
+			print_marker(f, next, cpu, ts);
+	}
+
+	ii("written %llu events, %llu switches, %f seconds\n",
+	 (unsigned long long) written_, (unsigned long long) switches,
+	 cpu_list_[next_cpu()].next_ts - base_ts_);
+}
+
+static int init_tasks(void)
+{
+	static const char *names[] = {
+		"render", "worker", "audio", "kworker", "net", "compositor",
+	};
+
+	if (!(task_list_ = calloc(tasks_, sizeof(*task_list_)))) {
+		ee("failed to allocate %u tasks\n", tasks_);
+		return 0;
+	}
+
+	for (uint32_t i = 0; i < tasks_; ++i) {
+		struct task *t = &task_list_[i];
+		const char *name = names[i % (sizeof(names) / sizeof(*names))];
+
+		t->pid = TASK_PID + i;
+		snprintf(t->comm, sizeof(t->comm), "%s-%u", name, i);
+	}
+
+	return 1;
+}
+
+static void help(const char *name)
+{
+	printf("Usage: %s [options]\n"
+	 "Generate synthetic ftrace text log for the viewer\n"
+	 "\033[2m"
+	 " --tasks <n>            number of tasks (%u)\n"
+	 " --cpus <n>             number of cpus (%u)\n"
+	 " --duration <sec>       trace duration in seconds (%.0f)\n"
+	 " --rate <n>             scheduler events per second (%.0f)\n"
+	 " --events <n>           stop after n events, overrides duration\n"
+	 " --mon-period-us <n>    'mon,' marker period, 0 disables (%u)\n"
+	 " --gpu-period-us <n>    'gpu,' marker period, 0 disables (%u)\n"
+	 " --present-period-us <n> 'present,' marker period, 0 disables (%u)\n"
+	 " --irq-rate <n>         interrupts per second, 0 disables (%.0f)\n"
+	 " --freq-period-us <n>   cpu_frequency period, 0 disables power "
+	 "events (%u)\n"
+	 " --marker-ratio <n>     text marker per n switches, 0 disables (%u)\n"
+	 " --migrate-events <0|1> emit sched_migrate_task (%u)\n"
+	 " --sched <type>         switch, stat or both (switch)\n"
+	 " --seed <n>             random seed (%llu)\n"
+	 " --output <file>        write to file instead of stdout\n"
+	 "\033[0m"
+	 "Example:\n"
+	 " ~/> %s --events 1000000 --output trace.txt\n", name, tasks_,
+	 cpus_, duration_, rate_, mon_period_, gpu_period_, present_period_,
+	 irq_rate_, freq_period_, marker_ratio_, migrate_events_,
+	 (unsigned long long) seed_, name);
+}
+
+static int opt(const char *arg, const char *argl)
+{
+	return (strcmp(arg, argl) == 0);
+}
+
+static int getopts(int argc, const char *argv[])
+{
+	const char *arg;
+
+	for (int i = 1; i < argc; ++i) {
+		arg = argv[i];
+		if (opt(arg, "--help") || opt(arg, "-h")) {
+			return 0;
+		} else if (i + 1 >= argc) {
+			ee("missing value for '%s'\n", arg);
+			return 0;
+		} else if (opt(arg, "--tasks")) {
+			tasks_ = atoi(argv[++i]);
+		} else if (opt(arg, "--cpus")) {
+			cpus_ = atoi(argv[++i]);
+		} else if (opt(arg, "--duration")) {
+			duration_ = atof(argv[++i]);
+		} else if (opt(arg, "--rate")) {
+			rate_ = atof(argv[++i]);
+		} else if (opt(arg, "--events")) {
+			events_ = strtoull(argv[++i], NULL, 0);
+		} else if (opt(arg, "--mon-period-us")) {
+			mon_period_ = atoi(argv[++i]);
+		} else if (opt(arg, "--gpu-period-us")) {
+			gpu_period_ = atoi(argv[++i]);
+		} else if (opt(arg, "--present-period-us")) {
+			present_period_ = atoi(argv[++i]);
+		} else if (opt(arg, "--irq-rate")) {
+			irq_rate_ = atof(argv[++i]);
+		} else if (opt(arg, "--freq-period-us")) {
+			freq_period_ = atoi(argv[++i]);
+		} else if (opt(arg, "--marker-ratio")) {
+			marker_ratio_ = atoi(argv[++i]);
+		} else if (opt(arg, "--migrate-events")) {
+			migrate_events_ = atoi(argv[++i]);
+		} else if (opt(arg, "--seed")) {
+			seed_ = strtoull(argv[++i], NULL, 0);
+		} else if (opt(arg, "--output")) {
+			output_ = argv[++i];
+		} else if (opt(arg, "--sched")) {
+			arg = argv[++i];
+			sched_switch_ = opt(arg, "switch") || opt(arg, "both");
+			task_stat_ = opt(arg, "stat") || opt(arg, "both");
+		} else {
+			ee("unknown option '%s'\n", arg);
+			return 0;
+		}
+	}
+
+	if (!tasks_ || !cpus_ || cpus_ > MAX_CPUS || rate_ <= 0 || !seed_) {
+		ee("invalid tasks/cpus/rate/seed values\n");
+		return 0;
+	}
+
+	return 1;
+}
+
+int main(int argc, const char *argv[])
+{
+	FILE *f = stdout;
+
+	if (!getopts(argc, argv)) {
+		help(argv[0]);
+		return 1;
+	} else if (!init_tasks()) {
+		return 1;
+	} else if (output_ && !(f = fopen(output_, "w"))) {
+		ee("failed to open '%s'\n", output_);
+		return 1;
+	}
+
+	static char buf[1 << 20];
+	setvbuf(f, buf, _IOFBF, sizeof(buf));
+	generate(f);
+
+	if (fclose(f) != 0) {
+		ee("failed to write trace\n");
+		return 1;
+	}
+
+	free(task_list_);
+	return 0;
+}
@@ -1,6 +1,9 @@
 #include <vulkan/vk_layer.h>
 #include <trace/trace.h>
 #include <stdint.h>
+#include <stddef.h>
+#include <inttypes.h>
+#include <sys/syscall.h>
 
 #define ii(...) printf("(ii) " __VA_ARGS__)
 #define ee(...) {\
@@ -8,16 +11,22 @@
 	fprintf(stderr, "\033[2m(ee) %s:%d\033[0m\n", __func__, __LINE__);\
 }
 
-struct dispatch_table {
 #define decl_fn(name) PFN_##name name
 
-	/* instance */
+struct instance_table {
 	decl_fn(vkGetInstanceProcAddr);
-	decl_fn(vkCreateInstance);
 	decl_fn(vkDestroyInstance);
-	decl_fn(vkCreateDevice);
-	/* device */
+	decl_fn(vkGetPhysicalDeviceProperties);
+	decl_fn(vkGetPhysicalDeviceQueueFamilyProperties);
+	decl_fn(vkEnumerateDeviceExtensionProperties);
+	decl_fn(vkGetPhysicalDeviceCalibrateableTimeDomainsEXT);
+};
+
+struct device_table {
 	decl_fn(vkGetDeviceProcAddr);
+	decl_fn(vkDestroyDevice);
+	decl_fn(vkGetDeviceQueue);
+	decl_fn(vkGetDeviceQueue2);
 	decl_fn(vkQueueSubmit);
 	decl_fn(vkQueueWaitIdle);
 	decl_fn(vkDeviceWaitIdle);
@@ -26,23 +35,202 @@ struct dispatch_table {
 	decl_fn(vkWaitSemaphoresKHR);
 	decl_fn(vkWaitForPresentKHR);
 	decl_fn(vkQueuePresentKHR);
+	/* gpu timing */
+	decl_fn(vkCreateQueryPool);
+	decl_fn(vkDestroyQueryPool);
+	decl_fn(vkGetQueryPoolResults);
+	decl_fn(vkCreateCommandPool);
+	decl_fn(vkDestroyCommandPool);
+	decl_fn(vkAllocateCommandBuffers);
+	decl_fn(vkBeginCommandBuffer);
+	decl_fn(vkEndCommandBuffer);
+	decl_fn(vkCmdResetQueryPool);
+	decl_fn(vkCmdWriteTimestamp);
+	decl_fn(vkGetCalibratedTimestampsEXT);
+};
 
 #undef decl_fn
+
+#define MAX_OBJECTS 32
+#define MAX_QUEUES 64 /* power of two */
+#define MAX_JOBS 64 /* timed submits in flight per queue, power of two */
+#define CALIBRATE_NS 1000000000ULL /* re-calibrate gpu clock every second */
+
+static const char *CALIBRATED_TIMESTAMPS_EXT = "VK_EXT_calibrated_timestamps";
+
+/* dispatchable objects (instance, physical device, device, queue, command
+ * buffer) start with the loader dispatch pointer; it is the same for all
+ * objects created from one instance or one device, so it is used as a key
+ */
+struct instance_data {
+	void *key;
+	VkInstance inst;
+	struct instance_table fns;
+};
+
+struct device_data {
+	void *key;
+	VkDevice dev;
+	VkPhysicalDevice gpu;
+	struct instance_data *inst;
+	struct device_table fns;
+	PFN_vkSetDeviceLoaderData set_loader_data;
+	/* gpu timing, calibration is owned by harvest thread */
+	uint8_t timing;
+	uint8_t stop;
+	pthread_t harvest_thread;
+	double tick_ns;
+	uint64_t gpu_base;
+	uint64_t cpu_base;
+};
+
+enum job_state {
+	JOB_FREE,
+	JOB_CLAIMED,
+	JOB_SUBMITTED,
+	JOB_CANCELED, /* submit failed */
 };
 
-static struct dispatch_table dispatch_;
-static size_t trace_id_;
+/* every timed submit gets begin and end command buffers recorded once at
+ * timer creation: begin resets job queries and writes start timestamp, end
+ * writes stop timestamp
+ */
+struct gpu_job {
+	VkCommandBuffer begin;
+	VkCommandBuffer end;
+	uint64_t id; /* trace id of the submit */
+	uint64_t prev_start; /* to tell stale results of previous use */
+	pid_t tid;
+	uint8_t state;
+};
+
+/* single producer: queue is externally synchronized by the app; single
+ * consumer: harvest thread of the device
+ */
+struct gpu_timer {
+	VkQueryPool query_pool;
+	VkCommandPool cmd_pool;
+	uint32_t head;
+	uint32_t tail;
+	struct gpu_job jobs[MAX_JOBS];
+};
+
+/* per-queue submit sequence, so markers of one queue can be matched even
+ * when several threads submit to different queues at the same time
+ */
+struct queue_data {
+	VkQueue queue;
+	struct device_data *dev;
+	uint32_t family;
+	uint64_t mask; /* valid timestamp bits, 0 if not supported */
+	uint64_t seq;
+	struct gpu_timer *timer;
+	uint8_t timer_failed;
+};
+
+struct proc {
+	const char *name;
+	PFN_vkVoidFunction fn;
+	size_t offset; /* of next layer function in the table */
+};
+
+static struct instance_data instances_[MAX_OBJECTS];
+static struct device_data devices_[MAX_OBJECTS];
+static pthread_mutex_t objects_lock_ = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t trace_id_; /* global call id, updated atomically */
+static struct queue_data queues_[MAX_QUEUES];
 static const uint32_t MIN_LAYER_IFACE_VERSION = 2;
-static VkInstance instance_ = VK_NULL_HANDLE;
 
-VkResult vkmon_vkCreateInstance(const VkInstanceCreateInfo *inst_info,
- const VkAllocationCallbacks *allocator, VkInstance *inst)
+static inline void *get_key(const void *obj)
 {
-	if (instance_ != VK_NULL_HANDLE) {
-		ee("Vulkan instance already exists, only one is supported\n");
-		return VK_ERROR_INITIALIZATION_FAILED;
+	return *(void **) obj;
+}
+
+/* lookups are lock free: slots are filled before key is published and
+ * objects must not be used by the app while they are being destroyed
+ */
+static struct instance_data *get_instance(const void *obj)
+{
+	void *key = get_key(obj);
+
+	for (uint8_t i = 0; i < MAX_OBJECTS; ++i) {
+		if (__atomic_load_n(&instances_[i].key, __ATOMIC_ACQUIRE) == key)
+			return &instances_[i];
 	}
 
+	return NULL;
+}
+
+static struct device_data *get_device(const void *obj)
+{
+	void *key = get_key(obj);
+
+	for (uint8_t i = 0; i < MAX_OBJECTS; ++i) {
+		if (__atomic_load_n(&devices_[i].key, __ATOMIC_ACQUIRE) == key)
+			return &devices_[i];
+	}
+
+	return NULL;
+}
+
+static struct instance_data *add_instance(VkInstance inst,
+ const struct instance_table *fns)
+{
+	struct instance_data *data = NULL;
+
+	pthread_mutex_lock(&objects_lock_);
+	for (uint8_t i = 0; i < MAX_OBJECTS; ++i) {
+		if (!instances_[i].key) {
+			data = &instances_[i];
+			data->inst = inst;
+			data->fns = *fns;
+			__atomic_store_n(&data->key, get_key(inst),
+			 __ATOMIC_RELEASE);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&objects_lock_);
+
+	if (!data)
+		ee("too many instances, max %u\n", MAX_OBJECTS);
+
+	return data;
+}
+
+static struct device_data *add_device(VkDevice dev,
+ const struct device_table *fns)
+{
+	struct device_data *data = NULL;
+
+	pthread_mutex_lock(&objects_lock_);
+	for (uint8_t i = 0; i < MAX_OBJECTS; ++i) {
+		if (!devices_[i].key) {
+			data = &devices_[i];
+			data->dev = dev;
+			data->fns = *fns;
+			__atomic_store_n(&data->key, get_key(dev),
+			 __ATOMIC_RELEASE);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&objects_lock_);
+
+	if (!data)
+		ee("too many devices, max %u\n", MAX_OBJECTS);
+
+	return data;
+}
+
+static void remove_object(void **key)
+{
+	pthread_mutex_lock(&objects_lock_);
+	__atomic_store_n(key, NULL, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&objects_lock_);
+}
+
+VkResult vkmon_vkCreateInstance(const VkInstanceCreateInfo *inst_info,
+ const VkAllocationCallbacks *allocator, VkInstance *inst)
+{
 	VkLayerInstanceCreateInfo *layer_info =
 	 (VkLayerInstanceCreateInfo *) inst_info;
 
@@ -86,79 +274,707 @@ VkResult vkmon_vkCreateInstance(const VkInstanceCreateInfo *inst_info,
 	/* now we can actually use our instance link */
 	layer_info->u.pLayerInfo = link;
 
+	/* open marker file now, not on first intercepted call */
+	if (trace_open(NULL) < 0)
+		ee("failed to open trace marker, tracing is off\n");
+
+	struct instance_table fns;
+
 #define getproc(name) (PFN_##name) get_instance_proc(*inst, #name)
 #define setproc(name)\
-	dispatch_.name = getproc(name);\
-	if (!dispatch_.name) {\
+	fns.name = getproc(name);\
+	if (!fns.name) {\
 		ee(#name " not found\n");\
 		return VK_ERROR_INITIALIZATION_FAILED;\
 	}
 
 	setproc(vkGetInstanceProcAddr);
-	setproc(vkCreateInstance);
 	setproc(vkDestroyInstance);
-	setproc(vkCreateDevice);
+	setproc(vkGetPhysicalDeviceProperties);
+	setproc(vkGetPhysicalDeviceQueueFamilyProperties);
+	setproc(vkEnumerateDeviceExtensionProperties);
+	fns.vkGetPhysicalDeviceCalibrateableTimeDomainsEXT =
+	 getproc(vkGetPhysicalDeviceCalibrateableTimeDomainsEXT);
 
 #undef setproc
 #undef getproc
+
+	if (!add_instance(*inst, &fns)) {
+		fns.vkDestroyInstance(*inst, allocator);
+		return VK_ERROR_INITIALIZATION_FAILED;
+	}
+
 	return VK_SUCCESS;
 }
 
+void vkmon_vkDestroyInstance(VkInstance inst,
+ const VkAllocationCallbacks *allocator)
+{
+	struct instance_data *data;
+
+	if (inst == VK_NULL_HANDLE || !(data = get_instance(inst)))
+		return;
+
+	PFN_vkDestroyInstance destroy = data->fns.vkDestroyInstance;
+	remove_object(&data->key);
+	destroy(inst, allocator);
+}
+
+static inline uint64_t next_id(void)
+{
+	return __atomic_fetch_add(&trace_id_, 1, __ATOMIC_RELAXED);
+}
+
+/* open addressing on queue handle, slots are claimed once and never freed;
+ * queues live as long as their device, and there are only a few of them
+ */
+static struct queue_data *get_queue(VkQueue queue)
+{
+	uint32_t i = ((uintptr_t) queue >> 4) & (MAX_QUEUES - 1);
+
+	for (uint32_t n = 0; n < MAX_QUEUES; ++n) {
+		struct queue_data *q = &queues_[(i + n) & (MAX_QUEUES - 1)];
+		VkQueue cur = __atomic_load_n(&q->queue, __ATOMIC_ACQUIRE);
+
+		if (cur == VK_NULL_HANDLE) {
+			VkQueue expected = VK_NULL_HANDLE;
+			if (__atomic_compare_exchange_n(&q->queue, &expected, queue,
+			 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+				cur = queue;
+			else
+				cur = expected; /* someone else claimed it */
+		}
+
+		if (cur == queue)
+			return q;
+	}
+
+	return NULL; /* table is full */
+}
+
+static inline uint64_t next_queue_seq(struct queue_data *q)
+{
+	if (!q)
+		return UINT64_MAX;
+
+	return __atomic_fetch_add(&q->seq, 1, __ATOMIC_RELAXED);
+}
+
+/* GPU timing
+ *
+ * Every submit is wrapped with timestamp queries: begin command buffer goes
+ * first into the first batch and end command buffer goes last into the
+ * last batch, so semaphore waits are not counted. Results are harvested by
+ * a thread per device, converted to CLOCK_MONOTONIC with
+ * VK_EXT_calibrated_timestamps and emitted as 'gpu,' markers with job id
+ * equal to the submit trace id. Offset in the marker is 0, so trace has to
+ * be recorded with mono trace_clock to line up with scheduler events.
+ *
+ * Set VKMON_GPU_TIMING=0 to disable.
+ */
+static uint8_t has_calibrated_timestamps(struct instance_data *inst,
+ VkPhysicalDevice gpu)
+{
+	const struct instance_table *fns = &inst->fns;
+	VkExtensionProperties *props;
+	VkTimeDomainEXT domains[8];
+	uint32_t count = 0;
+	uint8_t found = 0;
+
+	if (!fns->vkGetPhysicalDeviceCalibrateableTimeDomainsEXT)
+		return 0;
+	else if (fns->vkEnumerateDeviceExtensionProperties(gpu, NULL, &count,
+	 NULL) != VK_SUCCESS || !count)
+		return 0;
+	else if (!(props = malloc(count * sizeof(*props))))
+		return 0;
+
+	if (fns->vkEnumerateDeviceExtensionProperties(gpu, NULL, &count,
+	 props) == VK_SUCCESS) {
+		for (uint32_t i = 0; i < count && !found; ++i) {
+			found = strcmp(props[i].extensionName,
+			 CALIBRATED_TIMESTAMPS_EXT) == 0;
+		}
+	}
+
+	free(props);
+	if (!found)
+		return 0;
+
+	/* incomplete is fine, only first few domains matter */
+	count = sizeof(domains) / sizeof(domains[0]);
+	if (fns->vkGetPhysicalDeviceCalibrateableTimeDomainsEXT(gpu, &count,
+	 domains) < 0)
+		return 0;
+
+	uint8_t mask = 0;
+	for (uint32_t i = 0; i < count; ++i) {
+		if (domains[i] == VK_TIME_DOMAIN_DEVICE_EXT)
+			mask |= 1;
+		else if (domains[i] == VK_TIME_DOMAIN_CLOCK_MONOTONIC_EXT)
+			mask |= 2;
+	}
+
+	return mask == 3;
+}
+
+static uint8_t want_timing(struct instance_data *inst, VkPhysicalDevice gpu)
+{
+	const char *env = getenv("VKMON_GPU_TIMING");
+	VkPhysicalDeviceProperties props;
+
+	if (env && atoi(env) == 0)
+		return 0;
+
+	inst->fns.vkGetPhysicalDeviceProperties(gpu, &props);
+	if (props.limits.timestampPeriod <= 0) {
+		ee("GPU timestamps are not supported, timing is off\n");
+		return 0;
+	} else if (!has_calibrated_timestamps(inst, gpu)) {
+		ee("%s is not supported, timing is off\n",
+		 CALIBRATED_TIMESTAMPS_EXT);
+		return 0;
+	}
+
+	return 1;
+}
+
+static inline uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint8_t calibrate(struct device_data *data)
+{
+	VkCalibratedTimestampInfoEXT info[2] = {
+		{
+			VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT, NULL,
+			VK_TIME_DOMAIN_DEVICE_EXT,
+		},
+		{
+			VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT, NULL,
+			VK_TIME_DOMAIN_CLOCK_MONOTONIC_EXT,
+		},
+	};
+	uint64_t ts[2];
+	uint64_t deviation;
+
+	if (data->fns.vkGetCalibratedTimestampsEXT(data->dev, 2, info, ts,
+	 &deviation) != VK_SUCCESS)
+		return 0;
+
+	data->gpu_base = ts[0];
+	data->cpu_base = ts[1];
+	return 1;
+}
+
+static uint64_t to_cpu_ns(struct device_data *data, uint64_t mask,
+ uint64_t ticks)
+{
+	int64_t delta = (ticks - data->gpu_base) & mask;
+
+	/* counter may wrap around when it has less than 64 valid bits */
+	if (mask != UINT64_MAX && (uint64_t) delta > (mask >> 1))
+		delta -= (int64_t) (mask + 1);
+
+	return data->cpu_base + delta * data->tick_ns;
+}
+
+static void destroy_timer(struct device_data *data, struct gpu_timer *timer)
+{
+	VkDevice dev = data->dev;
+
+	if (timer->cmd_pool != VK_NULL_HANDLE)
+		data->fns.vkDestroyCommandPool(dev, timer->cmd_pool, NULL);
+
+	if (timer->query_pool != VK_NULL_HANDLE)
+		data->fns.vkDestroyQueryPool(dev, timer->query_pool, NULL);
+
+	free(timer);
+}
+
+static uint8_t record_job(struct device_data *data, struct gpu_timer *timer,
+ uint32_t i)
+{
+	const struct device_table *fns = &data->fns;
+	struct gpu_job *job = &timer->jobs[i];
+	VkCommandBufferBeginInfo info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+		/* batch may still be pending when job is reused */
+		.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT,
+	};
+
+	if (fns->vkBeginCommandBuffer(job->begin, &info) != VK_SUCCESS)
+		return 0;
+
+	fns->vkCmdResetQueryPool(job->begin, timer->query_pool, 2 * i, 2);
+	fns->vkCmdWriteTimestamp(job->begin, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+	 timer->query_pool, 2 * i);
+
+	if (fns->vkEndCommandBuffer(job->begin) != VK_SUCCESS)
+		return 0;
+	else if (fns->vkBeginCommandBuffer(job->end, &info) != VK_SUCCESS)
+		return 0;
+
+	fns->vkCmdWriteTimestamp(job->end, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+	 timer->query_pool, 2 * i + 1);
+
+	return fns->vkEndCommandBuffer(job->end) == VK_SUCCESS;
+}
+
+/* called on first submit to the queue, queries are reset on that queue
+ * before any job uses them
+ */
+static struct gpu_timer *create_timer(struct queue_data *q)
+{
+	struct device_data *data = q->dev;
+	const struct device_table *fns = &data->fns;
+	VkCommandBuffer cmds[2 * MAX_JOBS + 1];
+	VkCommandBuffer reset = VK_NULL_HANDLE;
+	struct gpu_timer *timer;
+
+	if (!(timer = calloc(1, sizeof(*timer))))
+		return NULL;
+
+	VkQueryPoolCreateInfo query_info = {
+		.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+		.queryType = VK_QUERY_TYPE_TIMESTAMP,
+		.queryCount = 2 * MAX_JOBS,
+	};
+
+	VkCommandPoolCreateInfo pool_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+		.queueFamilyIndex = q->family,
+	};
+
+	VkCommandBufferAllocateInfo alloc_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+		.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+		.commandBufferCount = 2 * MAX_JOBS + 1,
+	};
+
+	if (fns->vkCreateQueryPool(data->dev, &query_info, NULL,
+	 &timer->query_pool) != VK_SUCCESS) {
+		goto err;
+	} else if (fns->vkCreateCommandPool(data->dev, &pool_info, NULL,
+	 &timer->cmd_pool) != VK_SUCCESS) {
+		goto err;
+	}
+
+	alloc_info.commandPool = timer->cmd_pool;
+	if (fns->vkAllocateCommandBuffers(data->dev, &alloc_info,
+	 cmds) != VK_SUCCESS)
+		goto err;
+
+	/* layer-made command buffers need loader dispatch pointer */
+	for (uint32_t i = 0; i < 2 * MAX_JOBS + 1; ++i) {
+		if (data->set_loader_data(data->dev, cmds[i]) != VK_SUCCESS)
+			goto err;
+	}
+
+	for (uint32_t i = 0; i < MAX_JOBS; ++i) {
+		timer->jobs[i].begin = cmds[2 * i];
+		timer->jobs[i].end = cmds[2 * i + 1];
+		if (!record_job(data, timer, i))
+			goto err;
+	}
+
+	reset = cmds[2 * MAX_JOBS];
+
+	VkCommandBufferBeginInfo begin_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+		.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+	};
+
+	VkSubmitInfo submit_info = {
+		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+		.commandBufferCount = 1,
+		.pCommandBuffers = &reset,
+	};
+
+	if (fns->vkBeginCommandBuffer(reset, &begin_info) != VK_SUCCESS)
+		goto err;
+
+	fns->vkCmdResetQueryPool(reset, timer->query_pool, 0, 2 * MAX_JOBS);
+
+	if (fns->vkEndCommandBuffer(reset) != VK_SUCCESS)
+		goto err;
+	else if (fns->vkQueueSubmit(q->queue, 1, &submit_info,
+	 VK_NULL_HANDLE) != VK_SUCCESS)
+		goto err;
+
+	return timer;
+err:
+	ee("failed to create GPU timer for queue %p\n", (void *) q->queue);
+	destroy_timer(data, timer);
+	return NULL;
+}
+
+static struct gpu_job *claim_job(struct queue_data *q, uint64_t id)
+{
+	struct gpu_timer *timer = q->timer;
+	struct gpu_job *job;
+
+	if (!timer) {
+		if (q->timer_failed || !q->mask) {
+			return NULL;
+		} else if (!(timer = create_timer(q))) {
+			q->timer_failed = 1;
+			return NULL;
+		}
+
+		__atomic_store_n(&q->timer, timer, __ATOMIC_RELEASE);
+	}
+
+	uint32_t head = timer->head;
+	if (head - __atomic_load_n(&timer->tail, __ATOMIC_ACQUIRE) >= MAX_JOBS)
+		return NULL; /* harvest is behind, submit goes untimed */
+
+	job = &timer->jobs[head & (MAX_JOBS - 1)];
+	job->id = id;
+	job->tid = syscall(SYS_gettid);
+	job->state = JOB_CLAIMED;
+	__atomic_store_n(&timer->head, head + 1, __ATOMIC_RELEASE);
+	return job;
+}
+
+/* device group submits carry per command buffer masks, leave them alone */
+static uint8_t can_wrap(const VkSubmitInfo *info)
+{
+	const VkSubmitInfo *next = (const VkSubmitInfo *) info->pNext;
+
+	for (; next; next = (const VkSubmitInfo *) next->pNext) {
+		if (next->sType == VK_STRUCTURE_TYPE_DEVICE_GROUP_SUBMIT_INFO)
+			return 0;
+	}
+
+	return 1;
+}
+
+static VkResult submit_job(struct device_data *data, VkQueue queue,
+ uint32_t count, const VkSubmitInfo *submits, VkFence fence,
+ struct gpu_job *job)
+{
+	uint32_t first_count = submits[0].commandBufferCount;
+	uint32_t last_count = submits[count - 1].commandBufferCount;
+	VkCommandBuffer first[first_count + 2];
+	VkCommandBuffer last[last_count + 1];
+	VkSubmitInfo infos[count];
+	VkResult res;
+
+	memcpy(infos, submits, sizeof(infos));
+
+	first[0] = job->begin;
+	if (first_count) {
+		memcpy(first + 1, submits[0].pCommandBuffers,
+		 first_count * sizeof(*first));
+	}
+
+	if (count == 1) {
+		first[++first_count] = job->end;
+	} else {
+		if (last_count) {
+			memcpy(last, submits[count - 1].pCommandBuffers,
+			 last_count * sizeof(*last));
+		}
+
+		last[last_count++] = job->end;
+		infos[count - 1].commandBufferCount = last_count;
+		infos[count - 1].pCommandBuffers = last;
+	}
+
+	infos[0].commandBufferCount = first_count + 1;
+	infos[0].pCommandBuffers = first;
+
+	res = data->fns.vkQueueSubmit(queue, count, infos, fence);
+	__atomic_store_n(&job->state, res == VK_SUCCESS ? JOB_SUBMITTED :
+	 JOB_CANCELED, __ATOMIC_RELEASE);
+	return res;
+}
+
+static void emit_job(struct queue_data *q, struct gpu_job *job,
+ uint64_t start, uint64_t stop)
+{
+	uint64_t start_ns = to_cpu_ns(q->dev, q->mask, start);
+	uint64_t stop_ns = to_cpu_ns(q->dev, q->mask, stop);
+
+	if (stop_ns < start_ns)
+		stop_ns = start_ns;
+
+	trace_marker("gpu,0,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%f,%d",
+	 job->id, start_ns, stop_ns, (stop_ns - start_ns) / 1e6, job->tid);
+}
+
+/* jobs are harvested in submit order, stops at first one still running */
+static uint32_t harvest_jobs(struct queue_data *q)
+{
+	struct device_data *data = q->dev;
+	struct gpu_timer *timer = q->timer;
+	uint32_t head = __atomic_load_n(&timer->head, __ATOMIC_ACQUIRE);
+	uint32_t count = 0;
+
+	for (; timer->tail != head; ++count) {
+		uint32_t i = timer->tail & (MAX_JOBS - 1);
+		struct gpu_job *job = &timer->jobs[i];
+		uint8_t state = __atomic_load_n(&job->state, __ATOMIC_ACQUIRE);
+		uint64_t res[4]; /* start, available, stop, available */
+
+		if (state == JOB_CLAIMED)
+			break;
+
+		if (state == JOB_SUBMITTED) {
+			VkResult ret = data->fns.vkGetQueryPoolResults(
+			 data->dev, timer->query_pool, 2 * i, 2, sizeof(res),
+			 res, 2 * sizeof(uint64_t), VK_QUERY_RESULT_64_BIT |
+			 VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+
+			if (ret != VK_SUCCESS && ret != VK_NOT_READY)
+				break;
+			else if (!res[1] || !res[3])
+				break;
+			else if (res[0] == job->prev_start)
+				break; /* queries are not reset yet */
+
+			job->prev_start = res[0];
+			emit_job(q, job, res[0], res[2]);
+		}
+
+		uint32_t tail = timer->tail + 1;
+		__atomic_store_n(&job->state, JOB_FREE, __ATOMIC_RELAXED);
+		__atomic_store_n(&timer->tail, tail, __ATOMIC_RELEASE);
+	}
+
+	return count;
+}
+
+static uint32_t harvest_device(struct device_data *data)
+{
+	uint32_t count = 0;
+
+	for (uint32_t i = 0; i < MAX_QUEUES; ++i) {
+		struct queue_data *q = &queues_[i];
+
+		if (__atomic_load_n(&q->dev, __ATOMIC_ACQUIRE) != data)
+			continue;
+		else if (__atomic_load_n(&q->timer, __ATOMIC_ACQUIRE))
+			count += harvest_jobs(q);
+	}
+
+	return count;
+}
+
+static void *harvest_loop(void *arg)
+{
+	struct device_data *data = (struct device_data *) arg;
+	struct timespec ts = { 0, 1000000 }; /* 1 ms */
+	uint64_t calibrated = now_ns();
+
+	while (!__atomic_load_n(&data->stop, __ATOMIC_ACQUIRE)) {
+		uint64_t now = now_ns();
+
+		/* clocks drift apart, keep conversion fresh */
+		if (now - calibrated >= CALIBRATE_NS && calibrate(data))
+			calibrated = now;
+
+		if (!harvest_device(data))
+			nanosleep(&ts, NULL);
+	}
+
+	harvest_device(data);
+	return NULL;
+}
+
+static uint8_t start_timing(struct device_data *data)
+{
+	VkPhysicalDeviceProperties props;
+
+	data->inst->fns.vkGetPhysicalDeviceProperties(data->gpu, &props);
+	data->tick_ns = props.limits.timestampPeriod;
+
+	if (!data->set_loader_data) {
+		ee("Loader does not provide vkSetDeviceLoaderData\n");
+		return 0;
+	} else if (!calibrate(data)) {
+		ee("failed to calibrate GPU timestamps\n");
+		return 0;
+	} else if (pthread_create(&data->harvest_thread, NULL, harvest_loop,
+	 data) != 0) {
+		ee("failed to start harvest thread\n");
+		return 0;
+	}
+
+	return 1;
+}
+
+static void stop_timing(struct device_data *data)
+{
+	__atomic_store_n(&data->stop, 1, __ATOMIC_RELEASE);
+	pthread_join(data->harvest_thread, NULL);
+
+	for (uint32_t i = 0; i < MAX_QUEUES; ++i) {
+		struct queue_data *q = &queues_[i];
+
+		if (q->dev != data)
+			continue;
+
+		if (q->timer)
+			destroy_timer(data, q->timer);
+
+		q->timer = NULL;
+		q->timer_failed = 0;
+		__atomic_store_n(&q->dev, NULL, __ATOMIC_RELEASE);
+	}
+}
+
+static void init_queue(struct device_data *data, VkQueue queue,
+ uint32_t family)
+{
+	struct queue_data *q;
+
+	if (queue == VK_NULL_HANDLE || !(q = get_queue(queue)))
+		return;
+	else if (__atomic_load_n(&q->dev, __ATOMIC_ACQUIRE) == data)
+		return;
+
+	q->family = family;
+	q->mask = 0;
+
+	if (data->timing) {
+		const struct instance_table *fns = &data->inst->fns;
+		uint32_t count = 0;
+
+		fns->vkGetPhysicalDeviceQueueFamilyProperties(data->gpu, &count,
+		 NULL);
+
+		VkQueueFamilyProperties props[count ? count : 1];
+		fns->vkGetPhysicalDeviceQueueFamilyProperties(data->gpu, &count,
+		 props);
+
+		uint32_t bits = family < count ?
+		 props[family].timestampValidBits : 0;
+
+		if (bits >= 64)
+			q->mask = UINT64_MAX;
+		else if (bits)
+			q->mask = (1ULL << bits) - 1;
+	}
+
+	__atomic_store_n(&q->dev, data, __ATOMIC_RELEASE);
+}
+
+void vkmon_vkGetDeviceQueue(VkDevice dev, uint32_t family, uint32_t index,
+ VkQueue *queue)
+{
+	struct device_data *data = get_device(dev);
+
+	data->fns.vkGetDeviceQueue(dev, family, index, queue);
+	init_queue(data, *queue, family);
+}
+
+void vkmon_vkGetDeviceQueue2(VkDevice dev, const VkDeviceQueueInfo2 *info,
+ VkQueue *queue)
+{
+	struct device_data *data = get_device(dev);
+
+	data->fns.vkGetDeviceQueue2(dev, info, queue);
+	init_queue(data, *queue, info->queueFamilyIndex);
+}
+
 VkResult vkmon_vkQueueSubmit(const VkQueue queue, uint32_t submit_count,
  const VkSubmitInfo *submits, const VkFence fence)
 {
-	trace_marker("%s id %zu", __func__, trace_id_++);
-	return dispatch_.vkQueueSubmit(queue, submit_count, submits, fence);
+	struct device_data *data = get_device(queue);
+	struct queue_data *q = get_queue(queue);
+	struct gpu_job *job = NULL;
+	uint64_t id = next_id();
+
+	trace_marker("%s id %" PRIu64 " queue %p seq %" PRIu64, __func__,
+	 id, (void *) queue, next_queue_seq(q));
+
+	if (!data->timing || !submit_count || !q || q->dev != data) {
+		/* untimed */
+	} else if (can_wrap(&submits[0]) &&
+	 can_wrap(&submits[submit_count - 1])) {
+		job = claim_job(q, id);
+	}
+
+	if (job) {
+		return submit_job(data, queue, submit_count, submits, fence,
+		 job);
+	}
+
+	return data->fns.vkQueueSubmit(queue, submit_count, submits, fence);
 }
 
 VkResult vkmon_vkQueueWaitIdle(const VkQueue queue)
 {
-	trace_marker("%s id %zu", __func__, trace_id_++);
-	return dispatch_.vkQueueWaitIdle(queue);
+	struct device_data *data = get_device(queue);
+
+	trace_marker("%s id %" PRIu64 " queue %p", __func__, next_id(),
+	 (void *) queue);
+	return data->fns.vkQueueWaitIdle(queue);
 }
 
 VkResult vkmon_vkDeviceWaitIdle(const VkDevice dev)
 {
-	trace_marker("%s id %zu", __func__, trace_id_++);
-	return dispatch_.vkDeviceWaitIdle(dev);
+	struct device_data *data = get_device(dev);
+
+	trace_marker("%s id %" PRIu64, __func__, next_id());
+	return data->fns.vkDeviceWaitIdle(dev);
 }
 
 VkResult vkmon_vkWaitForFences(const VkDevice dev, uint32_t fence_count,
  const VkFence *fences, VkBool32 wait_all, uint64_t timeout)
 {
-	trace_marker("%s id %zu", __func__, trace_id_++);
-	return dispatch_.vkWaitForFences(dev, fence_count, fences, wait_all,
+	struct device_data *data = get_device(dev);
+
+	trace_marker("%s id %" PRIu64, __func__, next_id());
+	return data->fns.vkWaitForFences(dev, fence_count, fences, wait_all,
 	 timeout);
 }
 
 VkResult vkmon_vkWaitSemaphores(const VkDevice dev,
  const VkSemaphoreWaitInfo *wait_info, uint64_t timeout)
 {
-	trace_marker("%s id %zu", __func__, trace_id_++);
-	return dispatch_.vkWaitSemaphores(dev, wait_info, timeout);
+	struct device_data *data = get_device(dev);
+
+	trace_marker("%s id %" PRIu64, __func__, next_id());
+	return data->fns.vkWaitSemaphores(dev, wait_info, timeout);
 }
 
 VkResult vkmon_vkWaitSemaphoresKHR(const VkDevice dev,
  const VkSemaphoreWaitInfoKHR *wait_info, uint64_t timeout)
 {
-	trace_marker("%s id %zu", __func__, trace_id_++);
-	return dispatch_.vkWaitSemaphoresKHR(dev, wait_info, timeout);
+	struct device_data *data = get_device(dev);
+
+	trace_marker("%s id %" PRIu64, __func__, next_id());
+	return data->fns.vkWaitSemaphoresKHR(dev, wait_info, timeout);
 }
 
 VkResult vkmon_vkWaitForPresentKHR(const VkDevice dev,
  const VkSwapchainKHR swapchain, uint64_t id, uint64_t timeout)
 {
-	trace_marker("%s id %zu present id %zu", __func__, trace_id_++, id);
-	return dispatch_.vkWaitForPresentKHR(dev, swapchain, id, timeout);
+	struct device_data *data = get_device(dev);
+
+	trace_marker("%s id %" PRIu64 " present id %" PRIu64, __func__,
+	 next_id(), id);
+	return data->fns.vkWaitForPresentKHR(dev, swapchain, id, timeout);
 }
 
+/* data format: present,<frame>,<id>
+ * viewer makes frame lane of these, one per presenting thread
+ */
 VkResult vkmon_vkQueuePresentKHR(const VkQueue queue,
  const VkPresentInfoKHR *present_info)
 {
-	static size_t frame_count_;
-	trace_marker("%s id %zu frame %zu", __func__, trace_id_,
-	 frame_count_++);
-	return dispatch_.vkQueuePresentKHR(queue, present_info);
+	static uint64_t frame_count_;
+	struct device_data *data = get_device(queue);
+
+	trace_marker("present,%" PRIu64 ",%" PRIu64,
+	 __atomic_fetch_add(&frame_count_, 1, __ATOMIC_RELAXED), next_id());
+	return data->fns.vkQueuePresentKHR(queue, present_info);
 }
 
 VkResult vkmon_vkCreateDevice(VkPhysicalDevice gpu,
@@ -198,8 +1014,43 @@ VkResult vkmon_vkCreateDevice(VkPhysicalDevice gpu,
 		return VK_ERROR_INITIALIZATION_FAILED;
 	}
 
-	const PFN_vkCreateDevice create_dev =
-	 (PFN_vkCreateDevice) get_instance_proc(NULL, "vkCreateDevice");
+	struct instance_data *inst_data = get_instance(gpu);
+	if (inst_data == NULL) {
+		ee("Unknown physical device %p\n", (void *) gpu);
+		return VK_ERROR_INITIALIZATION_FAILED;
+	}
+
+	/* loader callback to set dispatch pointer of layer-made objects */
+	VkLayerDeviceCreateInfo *loader_info =
+	 (VkLayerDeviceCreateInfo *) dev_info;
+
+	while ((loader_info != NULL) &&
+	 ((loader_info->sType != VK_STRUCTURE_TYPE_LOADER_DEVICE_CREATE_INFO) ||
+	 (loader_info->function != VK_LOADER_DATA_CALLBACK))) {
+		loader_info = (VkLayerDeviceCreateInfo *) loader_info->pNext;
+	}
+
+	/* enable calibrated timestamps for the app if it did not */
+	uint32_t ext_count = dev_info->enabledExtensionCount;
+	const char *exts[ext_count + 1];
+	VkDeviceCreateInfo info = *dev_info;
+	uint8_t timing = want_timing(inst_data, gpu);
+	uint8_t enabled = 0;
+
+	for (uint32_t i = 0; i < ext_count; ++i) {
+		exts[i] = dev_info->ppEnabledExtensionNames[i];
+		if (strcmp(exts[i], CALIBRATED_TIMESTAMPS_EXT) == 0)
+			enabled = 1;
+	}
+
+	if (timing && !enabled) {
+		exts[ext_count] = CALIBRATED_TIMESTAMPS_EXT;
+		info.enabledExtensionCount = ext_count + 1;
+		info.ppEnabledExtensionNames = exts;
+	}
+
+	const PFN_vkCreateDevice create_dev = (PFN_vkCreateDevice)
+	 get_instance_proc(inst_data->inst, "vkCreateDevice");
 	if (create_dev == NULL) {
 		ee("Next layer does not provide a vkCreateDevice\n");
 		return VK_ERROR_INITIALIZATION_FAILED;
@@ -207,71 +1058,187 @@ VkResult vkmon_vkCreateDevice(VkPhysicalDevice gpu,
 
 	layer_info->u.pLayerInfo = link->pNext;
 
-	const VkResult res = create_dev(gpu, dev_info, allocator, dev);
+	const VkResult res = create_dev(gpu, &info, allocator, dev);
 	if (res != VK_SUCCESS) {
 		ee("Failed to create device\n");
 		return res;
 	}
 
-#define getproc(name) (PFN_##name) get_dev_proc(*dev, #name)
+	struct device_table fns;
+	memset(&fns, 0, sizeof(fns));
+
+	/* optional functions stay NULL and are hidden in vkGetDeviceProcAddr */
+#define getproc(name) fns.name = (PFN_##name) get_dev_proc(*dev, #name)
 #define setproc(name)\
-	dispatch_.name = getproc(name);\
-	if (!dispatch_.name) {\
+	getproc(name);\
+	if (!fns.name) {\
 		ee(#name " not found\n");\
 		return VK_ERROR_INITIALIZATION_FAILED;\
 	}
 
 	setproc(vkGetDeviceProcAddr);
+	setproc(vkDestroyDevice);
+	setproc(vkGetDeviceQueue);
+	getproc(vkGetDeviceQueue2);
 	setproc(vkQueueSubmit);
 	setproc(vkQueueWaitIdle);
 	setproc(vkDeviceWaitIdle);
 	setproc(vkWaitForFences);
-	setproc(vkWaitSemaphores);
-#if 0
-	setproc(vkWaitSemaphoresKHR);
-	setproc(vkWaitForPresentKHR);
-	setproc(vkQueuePresentKHR);
-#endif
+	getproc(vkWaitSemaphores);
+	getproc(vkWaitSemaphoresKHR);
+	getproc(vkWaitForPresentKHR);
+	getproc(vkQueuePresentKHR);
+
+	if (timing) {
+		getproc(vkCreateQueryPool);
+		getproc(vkDestroyQueryPool);
+		getproc(vkGetQueryPoolResults);
+		getproc(vkCreateCommandPool);
+		getproc(vkDestroyCommandPool);
+		getproc(vkAllocateCommandBuffers);
+		getproc(vkBeginCommandBuffer);
+		getproc(vkEndCommandBuffer);
+		getproc(vkCmdResetQueryPool);
+		getproc(vkCmdWriteTimestamp);
+		getproc(vkGetCalibratedTimestampsEXT);
+		if (!fns.vkGetCalibratedTimestampsEXT) {
+			ee("vkGetCalibratedTimestampsEXT not found\n");
+			timing = 0;
+		}
+	}
 
 #undef setproc
 #undef getproc
+
+	struct device_data *data = add_device(*dev, &fns);
+	if (!data) {
+		fns.vkDestroyDevice(*dev, allocator);
+		return VK_ERROR_INITIALIZATION_FAILED;
+	}
+
+	data->gpu = gpu;
+	data->inst = inst_data;
+	data->set_loader_data = loader_info ?
+	 loader_info->u.pfnSetDeviceLoaderData : NULL;
+	data->stop = 0;
+	data->timing = timing && start_timing(data);
 	return VK_SUCCESS;
 }
 
+void vkmon_vkDestroyDevice(VkDevice dev,
+ const VkAllocationCallbacks *allocator)
+{
+	struct device_data *data;
+
+	if (dev == VK_NULL_HANDLE || !(data = get_device(dev)))
+		return;
+
+	if (data->timing)
+		stop_timing(data);
+
+	PFN_vkDestroyDevice destroy = data->fns.vkDestroyDevice;
+	remove_object(&data->key);
+	destroy(dev, allocator);
+}
+
+PFN_vkVoidFunction vkmon_vkGetInstanceProcAddr(const VkInstance inst,
+ const char *name);
+PFN_vkVoidFunction vkmon_vkGetDeviceProcAddr(const VkDevice dev,
+ const char *name);
+
+#define instance_proc(fn) { #fn, (PFN_vkVoidFunction) vkmon_##fn, 0 }
+#define device_proc(fn) {\
+	#fn, (PFN_vkVoidFunction) vkmon_##fn, offsetof(struct device_table, fn)\
+}
+
+/* sorted by name for bsearch() */
+static const struct proc instance_procs_[] = {
+	instance_proc(vkCreateDevice),
+	instance_proc(vkCreateInstance),
+	instance_proc(vkDestroyInstance),
+	instance_proc(vkGetInstanceProcAddr),
+};
+
+static const struct proc device_procs_[] = {
+	device_proc(vkDestroyDevice),
+	device_proc(vkDeviceWaitIdle),
+	device_proc(vkGetDeviceProcAddr),
+	device_proc(vkGetDeviceQueue),
+	device_proc(vkGetDeviceQueue2),
+	device_proc(vkQueuePresentKHR),
+	device_proc(vkQueueSubmit),
+	device_proc(vkQueueWaitIdle),
+	device_proc(vkWaitForFences),
+	device_proc(vkWaitForPresentKHR),
+	device_proc(vkWaitSemaphores),
+	device_proc(vkWaitSemaphoresKHR),
+};
+
+#undef device_proc
+#undef instance_proc
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof(a[0]))
+
+static int cmp_proc(const void *name, const void *proc)
+{
+	return strcmp((const char *) name, ((const struct proc *) proc)->name);
+}
+
+static inline const struct proc *find_proc(const struct proc *procs,
+ size_t count, const char *name)
+{
+	if (name[0] != 'v' || name[1] != 'k')
+		return NULL;
+
+	return (const struct proc *) bsearch(name, procs, count, sizeof(*procs),
+	 cmp_proc);
+}
+
+/* NULL if next layer does not provide intercepted function */
+static inline PFN_vkVoidFunction get_device_proc(struct device_data *data,
+ const struct proc *proc)
+{
+	PFN_vkVoidFunction next =
+	 *(PFN_vkVoidFunction *) ((char *) &data->fns + proc->offset);
+	return next ? proc->fn : NULL;
+}
+
 PFN_vkVoidFunction vkmon_vkGetInstanceProcAddr(const VkInstance inst,
  const char *name)
 {
-	if (strcmp(name, "vkCreateInstance") == 0) {
-		return (PFN_vkVoidFunction) vkmon_vkCreateInstance;
-	} else if (strcmp(name, "vkCreateDevice") == 0) {
-		return (PFN_vkVoidFunction) vkmon_vkCreateDevice;
-	} else {
-		return dispatch_.vkGetInstanceProcAddr(inst, name);
+	struct instance_data *data;
+	const struct proc *proc;
+
+	if ((proc = find_proc(instance_procs_, ARRAY_SIZE(instance_procs_),
+	 name))) {
+		return proc->fn;
+	} else if (inst == VK_NULL_HANDLE || !(data = get_instance(inst))) {
+		return NULL;
 	}
+
+	PFN_vkVoidFunction next = data->fns.vkGetInstanceProcAddr(inst, name);
+
+	/* device functions can be queried with instance too */
+	if (next && (proc = find_proc(device_procs_, ARRAY_SIZE(device_procs_),
+	 name)))
+		return proc->fn;
+
+	return next;
 }
 
 PFN_vkVoidFunction vkmon_vkGetDeviceProcAddr(const VkDevice dev,
  const char *name)
 {
-#define else_if_call_fn(fn)\
-	} else if (strcmp(name, #fn) == 0) {\
-		return (PFN_vkVoidFunction) vkmon_##fn;\
-
-	if (strcmp(name, "vkQueueSubmit") == 0) {
-		return (PFN_vkVoidFunction) vkmon_vkQueueSubmit;
-	else_if_call_fn(vkQueueSubmit)
-	else_if_call_fn(vkQueueWaitIdle)
-	else_if_call_fn(vkDeviceWaitIdle)
-	else_if_call_fn(vkWaitForFences)
-	else_if_call_fn(vkWaitSemaphores)
-#if 0
-	else_if_call_fn(vkWaitSemaphoresKHR)
-	else_if_call_fn(vkWaitForPresentKHR)
-	else_if_call_fn(vkQueuePresentKHR)
-#endif
-	} else {
-		return dispatch_.vkGetDeviceProcAddr(dev, name);
-	}
+	struct device_data *data;
+	const struct proc *proc;
+
+	if (dev == VK_NULL_HANDLE || !(data = get_device(dev)))
+		return NULL;
+	else if ((proc = find_proc(device_procs_, ARRAY_SIZE(device_procs_),
+	 name)))
+		return get_device_proc(data, proc);
+
+	return data->fns.vkGetDeviceProcAddr(dev, name);
 }
 
 VkResult